@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include "sexp.hpp"
+
+// 評価済みの実引数の並び。primitive と lambda の束縛はリストを作らずにこれを受け取る。
+struct Args {
+  SExp const* data;
+  size_t size;
+  SExp operator[](size_t i) const {
+    assert(i < size);
+    return data[i];
+  }
+  SExp const* begin() const {
+    return data;
+  }
+  SExp const* end() const {
+    return data + size;
+  }
+};
+
+// 実引数を溜めておく場所。呼び出しごとに C++ の stack に置かれ、
+// 引数が inline_size 個を超えたときだけ heap を使う。
+class ArgBuffer {
+  static constexpr size_t inline_size = 8;
+  // SExp のデフォルトコンストラクタは確保を伴うので、生の領域に置く。
+  alignas(SExp) unsigned char storage[inline_size * sizeof(SExp)];
+  std::vector<SExp> spill;
+  size_t n;
+  SExp* inline_data() {
+    return reinterpret_cast<SExp*>(storage);
+  }
+  SExp const* inline_data() const {
+    return reinterpret_cast<SExp const*>(storage);
+  }
+public:
+  ArgBuffer() : spill{}, n{} {}
+  ArgBuffer(ArgBuffer const&) = delete;
+  ArgBuffer& operator=(ArgBuffer const&) = delete;
+  void push_back(SExp sexp) {
+    if(n < inline_size) {
+      new(inline_data() + n) SExp{sexp};
+    } else {
+      if(n == inline_size) {
+        spill.assign(inline_data(), inline_data() + n);
+      }
+      spill.push_back(sexp);
+    }
+    ++n;
+  }
+  Args args() const {
+    return Args{n <= inline_size ? inline_data() : spill.data(), n};
+  }
+};
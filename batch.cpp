@@ -0,0 +1,194 @@
+#include "batch.hpp"
+#include "eval.hpp"
+#include "parse.hpp"
+#include "task.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// <signal.h> の raise と衝突しないよう、システムヘッダの後に置く。
+#include "exceptions.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Job {
+  std::string path;
+  pid_t pid;
+  int fd;
+  Clock::time_point start;
+  std::string out;
+};
+
+std::vector<std::string> collect_scripts(std::vector<std::string> const& paths) {
+  namespace fs = std::filesystem;
+  std::vector<std::string> scripts;
+  for(auto const& path: paths) {
+    if(!fs::is_directory(path)) {
+      scripts.push_back(path);
+      continue;
+    }
+    std::vector<std::string> entries;
+    for(auto const& entry: fs::directory_iterator(path)) {
+      if(entry.is_regular_file()) {
+        entries.push_back(entry.path().string());
+      }
+    }
+    std::sort(begin(entries), end(entries));
+    scripts.insert(end(scripts), begin(entries), end(entries));
+  }
+  return scripts;
+}
+
+std::string run_script(std::string const& path, Limits const& limits) {
+  std::ifstream is(path);
+  if(!is) {
+    return "error\tcould not open " + path;
+  }
+  try {
+    BudgetScope budget{limits};
+    auto sexps = parse(is);
+    auto r = eval(script_env(), sexps);
+    run_tasks();
+    return "ok\t" + show(r.second);
+  } catch(Exception const&) {
+    return "error\t" + describe_exception();
+  }
+}
+
+// index は scripts の中での位置。別の directory の同じ名前の script と時系列がぶつからないように使う。
+[[noreturn]] void child(std::string const& path, size_t index, int fd, Limits const& limits) {
+  auto result = run_script(path, limits);
+  if(heap_profile::enabled) {
+    heap_profile::finish(path, "." + std::to_string(index) + "." + std::filesystem::path(path).filename().string());
+  }
+  char const* p = result.data();
+  size_t left = result.size();
+  while(left > 0) {
+    auto n = write(fd, p, left);
+    if(n <= 0) break;
+    p += n;
+    left -= n;
+  }
+  close(fd);
+  _exit(result.compare(0, 3, "ok\t") == 0 ? 0 : 1);
+}
+
+Job spawn(std::string const& path, size_t index, Limits const& limits) {
+  int fds[2];
+  if(pipe(fds) != 0) {
+    std::perror("pipe");
+    std::exit(2);
+  }
+  std::cout.flush();
+  std::cerr.flush();
+  auto start = Clock::now();
+  pid_t pid = fork();
+  if(pid < 0) {
+    std::perror("fork");
+    std::exit(2);
+  }
+  if(pid == 0) {
+    close(fds[0]);
+    child(path, index, fds[1], limits);
+  }
+  close(fds[1]);
+  return Job{path, pid, fds[0], start, {}};
+}
+
+// 成功なら true
+bool report(Job const& job, int status) {
+  auto elapsed = std::chrono::duration<double, std::milli>(Clock::now() - job.start).count();
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(3) << elapsed << "ms";
+  bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  auto tab = job.out.find('\t');
+  auto message = tab == std::string::npos ? std::string{} : job.out.substr(tab + 1);
+  if(ok) {
+    std::cout << "ok    " << ss.str() << ' ' << job.path << " => " << message << std::endl;
+  } else if(WIFSIGNALED(status)) {
+    std::cout << "crash " << ss.str() << ' ' << job.path << ": " << strsignal(WTERMSIG(status)) << std::endl;
+  } else {
+    std::cout << "FAIL  " << ss.str() << ' ' << job.path << ": " << message << std::endl;
+  }
+  return ok;
+}
+
+}
+
+int run_batch(std::vector<std::string> const& paths, int jobs, Limits const& limits) {
+  auto scripts = collect_scripts(paths);
+  if(jobs < 1) jobs = 1;
+  auto start = Clock::now();
+
+  std::vector<Job> running;
+  size_t next{}, failed{};
+  while(next < scripts.size() || !running.empty()) {
+    while(next < scripts.size() && static_cast<int>(running.size()) < jobs) {
+      running.push_back(spawn(scripts[next], next, limits));
+      ++next;
+    }
+    std::vector<pollfd> fds;
+    for(auto const& job: running) {
+      fds.push_back(pollfd{job.fd, POLLIN, 0});
+    }
+    if(poll(fds.data(), fds.size(), -1) < 0) {
+      if(errno == EINTR) continue;
+      std::perror("poll");
+      return 2;
+    }
+    for(size_t i{fds.size()}; i-- > 0;) {
+      if(fds[i].revents == 0) continue;
+      auto& job = running[i];
+      char buf[4096];
+      auto n = read(job.fd, buf, sizeof buf);
+      if(n > 0) {
+        job.out.append(buf, n);
+        continue;
+      }
+      close(job.fd);
+      int status;
+      waitpid(job.pid, &status, 0);
+      if(!report(job, status)) ++failed;
+      running.erase(begin(running) + i);
+    }
+  }
+
+  auto elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  std::cout << scripts.size() << " scripts: " << scripts.size() - failed << " ok, " << failed << " failed ("
+            << std::fixed << std::setprecision(3) << elapsed << "ms)" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
+
+std::string describe_exception() {
+  try {
+    throw;
+  } catch(UnboundVariableException const& e) {
+    return "unbound variable " + e.str;
+  } catch(InvalidApplicationException const& e) {
+    return "invalid application " + e.str;
+  } catch(BudgetExceededException const& e) {
+    return "budget exceeded: " + e.str;
+  } catch(InvalidBinaryException const& e) {
+    return e.str;
+  } catch(TaskFailedException const& e) {
+    return e.str;
+  } catch(DeadlockException const&) {
+    return "deadlock";
+  } catch(UnexpectedCharException const& e) {
+    return std::string{"unexpected char "} + e.c;
+  } catch(Exception const& e) {
+    return "exception at " + e.file + ':' + std::to_string(e.line);
+  }
+}
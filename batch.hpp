@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "budget.hpp"
+
+// prelude を読み込んだプロセスから script ごとに fork して並列に評価する。
+// paths にディレクトリを渡すと、その直下の通常ファイルをすべて対象にする。
+// 各 script は limits の予算で評価する。すべて成功すれば 0 を返す。
+int run_batch(std::vector<std::string> const& paths, int jobs, Limits const& limits);
+
+// 捕まえている Exception を人が読む説明にする。Exception の catch の中で呼ぶ。
+std::string describe_exception();
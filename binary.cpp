@@ -0,0 +1,297 @@
+#include "binary.hpp"
+#include "budget.hpp"
+#include "parse.hpp"
+#include "sexp_impl.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// <signal.h> の raise と衝突しないよう、システムヘッダの後に置く。
+#include "exceptions.hpp"
+
+namespace {
+
+static_assert(sizeof(SExp) == sizeof(void*), "SExp must be a bare pointer");
+static_assert(sizeof(SExp_) == 16 && offsetof(SExp_, _value) == 8, "unexpected SExp_ layout");
+static_assert(sizeof(Pair) == 16, "unexpected Pair layout");
+
+constexpr char magic[8] = {'i', 'l', 'i', 's', 'b', 'i', 'n', '2'};
+constexpr uint32_t byte_order = 0x01020304;
+constexpr uint64_t nil_ref = ~uint64_t{};
+
+struct Header {
+  char magic[8];
+  uint32_t byte_order;
+  uint32_t pointer_size;
+  uint64_t cells_offset;
+  uint64_t cells_size;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+  uint64_t root;
+  uint64_t reserved;
+};
+static_assert(sizeof(Header) % sizeof(SExp_) == 0, "cells must stay aligned");
+
+// ファイル上の cell。SExp_ と同じく、リストの背骨は cdr-coding で詰めて並べる。
+// Next と Last の pair は value が car への参照。Normal の pair は Cell の直後に
+// Pair 相当の参照 2 つが続く。
+struct Cell {
+  uint32_t tag;
+  uint8_t cdr_code;
+  uint8_t pad[3];
+  uint64_t value;
+};
+static_assert(sizeof(Cell) == sizeof(SExp_) && offsetof(Cell, cdr_code) == offsetof(SExp_, _cdr_code), "Cell must mirror SExp_");
+
+size_t cell_size(Tag tag, CdrCode code) {
+  return tag == Tag::Pair && code == CdrCode::Normal ? sizeof(SExp_) + sizeof(Pair) : sizeof(SExp_);
+}
+
+class Writer {
+  std::unordered_map<SExp_ const*, uint64_t> offsets;
+  std::vector<std::pair<SExp, CdrCode>> order;
+  std::unordered_map<std::string, uint64_t> string_offsets;
+  std::string strings;
+  uint64_t cells_size{};
+
+  uint64_t intern(char const* str) {
+    auto it = string_offsets.find(str);
+    if(it != end(string_offsets)) return it->second;
+    uint64_t offset = strings.size();
+    strings.append(str, std::strlen(str) + 1);
+    string_offsets.emplace(str, offset);
+    return offset;
+  }
+
+  uint64_t ref(SExp sexp) const {
+    if(null(sexp)) return nil_ref;
+    return offsets.at(ptr(sexp));
+  }
+
+public:
+  // 書き出す cell に offset を振る。長いリストでも native stack を食わないよう、明示的な stack で辿る。
+  // まだ書いていない cdr はその場で続けて並べ、背骨を cdr-coding で詰める。
+  void collect(SExp root) {
+    std::vector<SExp> stack{root};
+    auto assign = [&](SExp sexp, CdrCode code) {
+      offsets.emplace(ptr(sexp), cells_size);
+      order.emplace_back(sexp, code);
+      cells_size += cell_size(type(sexp), code);
+    };
+    while(!stack.empty()) {
+      auto sexp = stack.back();
+      stack.pop_back();
+      if(null(sexp) || offsets.count(ptr(sexp))) continue;
+      auto tag = type(sexp);
+      if(tag != Tag::Pair && tag != Tag::Integer && tag != Tag::Symbol && tag != Tag::String) {
+        raise_with_str(InvalidApplicationException, "write-binary: cannot serialize " + show(sexp));
+      }
+      if(tag != Tag::Pair) {
+        assign(sexp, CdrCode::Normal);
+        continue;
+      }
+      while(true) {
+        stack.push_back(car(sexp));
+        auto next = cdr(sexp);
+        if(null(next)) {
+          assign(sexp, CdrCode::Last);
+          break;
+        }
+        if(atomp(next) || offsets.count(ptr(next))) {
+          assign(sexp, CdrCode::Normal);
+          stack.push_back(next);
+          break;
+        }
+        assign(sexp, CdrCode::Next);
+        sexp = next;
+      }
+    }
+  }
+
+  void write(std::ostream& os, SExp root) {
+    std::vector<char> cells(cells_size);
+    for(auto [sexp, code]: order) {
+      auto offset = offsets.at(ptr(sexp));
+      Cell cell{static_cast<uint32_t>(type(sexp)), static_cast<uint8_t>(code), {}, 0};
+      switch(type(sexp)) {
+      case Tag::Integer:
+        cell.value = static_cast<uint64_t>(static_cast<int64_t>(cast<Tag::Integer>(sexp)));
+        break;
+      case Tag::Symbol:
+        cell.value = intern(cast<Tag::Symbol>(sexp));
+        break;
+      case Tag::String:
+        cell.value = intern(cast<Tag::String>(sexp));
+        break;
+      case Tag::Pair: {
+        if(code != CdrCode::Normal) {
+          cell.value = ref(car(sexp));
+          break;
+        }
+        cell.value = offset + sizeof(SExp_);
+        uint64_t pair[2] = {ref(car(sexp)), ref(cdr(sexp))};
+        std::memcpy(&cells[offset + sizeof(SExp_)], pair, sizeof pair);
+        break;
+      }
+      default:
+        raise(NeverComeException);
+      }
+      std::memcpy(&cells[offset], &cell, sizeof cell);
+    }
+
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof magic);
+    header.byte_order = byte_order;
+    header.pointer_size = sizeof(void*);
+    header.cells_offset = sizeof(Header);
+    header.cells_size = cells_size;
+    header.strings_offset = header.cells_offset + cells_size;
+    header.strings_size = strings.size();
+    header.root = ref(root);
+    os.write(reinterpret_cast<char const*>(&header), sizeof header);
+    os.write(cells.data(), cells.size());
+    os.write(strings.data(), strings.size());
+  }
+};
+
+[[noreturn]] void invalid(std::string const& path, char const* why) {
+  raise_with_str(InvalidBinaryException, path + ": " + why);
+}
+
+// 読み込みに失敗したら mapping を返す。成功したら読んだ S 式が使い続けるので残す。
+struct Mapping {
+  char* base;
+  size_t size;
+  ~Mapping() {
+    if(base) munmap(base, size);
+  }
+  char* release() {
+    return std::exchange(base, nullptr);
+  }
+};
+
+}
+
+void write_binary(std::string const& path, SExp sexp) {
+  Writer writer;
+  writer.collect(sexp);
+  std::ofstream os(path, std::ios::binary | std::ios::trunc);
+  if(!os) {
+    raise_with_str(InvalidBinaryException, path + ": could not open for writing");
+  }
+  writer.write(os, sexp);
+  if(!os) {
+    raise_with_str(InvalidBinaryException, path + ": write failed");
+  }
+}
+
+SExp read_binary(std::string const& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0) invalid(path, "could not open");
+  struct stat st;
+  if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+    close(fd);
+    invalid(path, "too short");
+  }
+  size_t size = st.st_size;
+  budget::charge(size, heap_profile::Kind::Binary);
+  // MAP_PRIVATE なので、offset の書き換えはファイルには戻らない。
+  auto base = static_cast<char*>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0));
+  close(fd);
+  if(base == MAP_FAILED) invalid(path, "mmap failed");
+  Mapping mapping{base, size};
+
+  Header header;
+  std::memcpy(&header, base, sizeof header);
+  if(std::memcmp(header.magic, magic, sizeof magic) != 0) invalid(path, "bad magic");
+  if(header.byte_order != byte_order || header.pointer_size != sizeof(void*)) invalid(path, "written on an incompatible machine");
+  // 和は uint64 で一周しうるので、引き算の形で範囲を確かめる。
+  if(header.cells_offset % sizeof(SExp_) != 0
+      || header.cells_size % sizeof(SExp_) != 0
+      || header.cells_offset < sizeof(Header)
+      || header.cells_offset > size
+      || header.cells_size > size - header.cells_offset
+      || header.strings_offset > size
+      || header.strings_size > size - header.strings_offset
+      || header.strings_offset < header.cells_offset
+      || header.strings_offset - header.cells_offset < header.cells_size) {
+    invalid(path, "corrupt header");
+  }
+
+  auto cells = base + header.cells_offset;
+  auto strings = base + header.strings_offset;
+  // 参照が cell の先頭を指しているかを確かめられるよう、先に全部の cell を見ておく。
+  std::vector<bool> starts(header.cells_size / sizeof(SExp_));
+  for(uint64_t offset{}; offset < header.cells_size;) {
+    Cell cell;
+    std::memcpy(&cell, cells + offset, sizeof cell);
+    auto tag = static_cast<Tag>(cell.tag);
+    auto code = static_cast<CdrCode>(cell.cdr_code);
+    if(tag != Tag::Pair && tag != Tag::Integer && tag != Tag::Symbol && tag != Tag::String) invalid(path, "bad tag");
+    if(code != CdrCode::Normal && (tag != Tag::Pair || (code != CdrCode::Next && code != CdrCode::Last))) invalid(path, "bad cdr code");
+    // pad は SExp_ の _immutable などに重なるので、書いたときと同じ 0 でなければならない。
+    if(cell.pad[0] || cell.pad[1] || cell.pad[2]) invalid(path, "bad padding");
+    if(offset + cell_size(tag, code) > header.cells_size) invalid(path, "truncated cell");
+    // Next の cdr は次の cell なので、それが存在しなければならない。
+    if(code == CdrCode::Next && offset + cell_size(tag, code) == header.cells_size) invalid(path, "truncated list");
+    starts[offset / sizeof(SExp_)] = true;
+    offset += cell_size(tag, code);
+  }
+  auto to_sexp = [&](uint64_t ref) -> SExp_* {
+    if(ref == nil_ref) return const_cast<SExp_*>(ptr(nil));
+    if(ref % sizeof(SExp_) != 0 || ref >= header.cells_size || !starts[ref / sizeof(SExp_)]) invalid(path, "bad reference");
+    return reinterpret_cast<SExp_*>(cells + ref);
+  };
+  auto to_string = [&](uint64_t offset) {
+    if(offset >= header.strings_size || strings[header.strings_size - 1] != '\0') invalid(path, "bad string");
+    return strings + offset;
+  };
+
+  for(uint64_t offset{}; offset < header.cells_size;) {
+    Cell cell;
+    std::memcpy(&cell, cells + offset, sizeof cell);
+    auto tag = static_cast<Tag>(cell.tag);
+    auto code = static_cast<CdrCode>(cell.cdr_code);
+    auto sexp = reinterpret_cast<SExp_*>(cells + offset);
+    switch(tag) {
+    case Tag::Integer:
+      sexp->_value.integer = static_cast<int>(static_cast<int64_t>(cell.value));
+      break;
+    case Tag::Symbol:
+      sexp->_value.symbol = to_string(cell.value);
+      break;
+    case Tag::String:
+      sexp->_value.string = to_string(cell.value);
+      break;
+    case Tag::Pair: {
+      if(code != CdrCode::Normal) {
+        sexp->_value.element = to_sexp(cell.value);
+        break;
+      }
+      uint64_t refs[2];
+      std::memcpy(refs, cells + offset + sizeof(SExp_), sizeof refs);
+      auto pair = reinterpret_cast<Pair*>(cells + offset + sizeof(SExp_));
+      pair->_car = to_sexp(refs[0]);
+      pair->_cdr = to_sexp(refs[1]);
+      sexp->_value.pair = pair;
+      break;
+    }
+    default:
+      raise(NeverComeException);
+    }
+    offset += cell_size(tag, code);
+  }
+  auto root = to_sexp(header.root);
+  mapping.release();
+  return root;
+}
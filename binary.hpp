@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+#include "sexp.hpp"
+
+// SExp のグラフを binary 形式で書き出す / 読み込む。
+//
+// ファイルはヘッダ、cell 領域、文字列領域の順に並ぶ。cell はメモリ上の SExp_ と
+// Pair と同じ配置 (リストの背骨は cdr-coding で詰めたもの) で書かれていて、
+// 参照は cell 領域の先頭からの offset になっている。
+// 共有された部分構造は 1 度だけ書かれる。読み込みはファイルを mmap し、offset を
+// その場でポインタに書き換えるだけなので、cell ごとの確保は起きない。
+// 整数の幅、ポインタの大きさ、endian は書いたマシンと同じでなければならない。
+
+void write_binary(std::string const& path, SExp sexp);
+SExp read_binary(std::string const& path);
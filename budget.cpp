@@ -0,0 +1,103 @@
+#include "budget.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include <sys/resource.h>
+
+#include "exceptions.hpp"
+
+namespace budget {
+
+namespace {
+
+constexpr long check_interval = 4096;
+
+constexpr State unlimited() {
+  return State{
+    check_interval,
+    check_interval,
+    0,
+    0,
+    std::numeric_limits<size_t>::max(),
+    std::numeric_limits<int>::max(),
+    0,
+    false,
+    {},
+  };
+}
+
+void refill() {
+  current.granted = check_interval;
+  if(current.steps > 0) {
+    current.granted = std::min(check_interval, current.steps - current.used);
+  }
+  current.countdown = current.granted;
+}
+
+}
+
+thread_local State current = unlimited();
+
+void out_of_heap() {
+  current.heap_left = 0;
+  raise_with_str(BudgetExceededException, "heap");
+}
+
+uintptr_t stack_limit_for(void const* base, size_t size) {
+  auto top = reinterpret_cast<uintptr_t>(base);
+  if(size <= stack_margin || size > top) return 0;
+  return top - size + stack_margin;
+}
+
+void too_deep() {
+  raise_with_str(BudgetExceededException, "depth");
+}
+
+void slow_tick() {
+  heap_profile::sample();
+  current.used += current.granted - current.countdown;
+  if(current.steps > 0 && current.used > current.steps) {
+    current.granted = current.countdown = 0;
+    raise_with_str(BudgetExceededException, "steps");
+  }
+  if(current.has_deadline && std::chrono::steady_clock::now() > current.deadline) {
+    current.granted = current.countdown = 0;
+    raise_with_str(BudgetExceededException, "time");
+  }
+  refill();
+}
+
+}
+
+// main の stack の大きさ。上限がなければ、おおよそ使えそうな大きさにしておく。
+size_t main_stack_size() {
+  constexpr size_t fallback = 256 << 20;
+  rlimit rl;
+  if(getrlimit(RLIMIT_STACK, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY) return fallback;
+  return std::min(static_cast<size_t>(rl.rlim_cur), fallback);
+}
+
+BudgetScope::BudgetScope(Limits const& limits) : saved{budget::current} {
+  auto& s = budget::current;
+  s = budget::unlimited();
+  // 最初の BudgetScope は main の stack の根元近くにあるので、ここから stack の大きさを測る。
+  // task の中では switch_to が task の stack の下限に差し替える。
+  s.stack_limit = saved.stack_limit != 0 ? saved.stack_limit : budget::stack_limit_for(__builtin_frame_address(0), main_stack_size());
+  s.steps = limits.steps;
+  if(limits.heap > 0) {
+    s.heap_left = limits.heap;
+  }
+  if(limits.depth > 0) {
+    s.depth_left = limits.depth;
+  }
+  if(limits.time.count() > 0) {
+    s.has_deadline = true;
+    s.deadline = std::chrono::steady_clock::now() + limits.time;
+  }
+  budget::refill();
+}
+
+BudgetScope::~BudgetScope() {
+  budget::current = saved;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "heap_profile.hpp"
+
+// 1 回の評価に許す資源の上限。0 は無制限。
+struct Limits {
+  long steps{};
+  size_t heap{};
+  std::chrono::milliseconds time{};
+  int depth{};
+};
+
+namespace budget {
+
+struct State {
+  long countdown;
+  long granted;
+  long used;
+  long steps;
+  size_t heap_left;
+  int depth_left;
+  // native stack がこの番地より下に伸びたら深すぎる。0 なら見ない。
+  uintptr_t stack_limit;
+  bool has_deadline;
+  std::chrono::steady_clock::time_point deadline;
+};
+
+extern thread_local State current;
+
+[[noreturn]] void out_of_heap();
+[[noreturn]] void too_deep();
+void slow_tick();
+
+// 今の native stack に、溢れる前に止まれるだけの余裕を残した下限。
+// 深さの上限を指定しなくても、stack を使い切る前に depth で止まる。
+constexpr size_t stack_margin = 256 << 10;
+uintptr_t stack_limit_for(void const* base, size_t size);
+
+// eval のたびに呼ぶ。
+inline void check_stack() {
+  if(reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) < current.stack_limit) too_deep();
+}
+
+// eval の 1 ステップごとに呼ぶ。時計を見るのは数千ステップに 1 回だけ。
+inline void tick() {
+  if(--current.countdown <= 0) slow_tick();
+}
+
+// allocator が確保する直前に、何を確保するかと一緒に呼ぶ。
+inline void charge(size_t bytes, heap_profile::Kind kind) {
+  if(bytes > current.heap_left) out_of_heap();
+  current.heap_left -= bytes;
+  heap_profile::record(kind, bytes);
+}
+
+}
+
+// スコープの間、この thread の評価に limits を課す。抜けると元の予算に戻るので、
+// 上限超過の例外の後もそのまま次の評価に使える。
+class BudgetScope {
+  budget::State saved;
+public:
+  explicit BudgetScope(Limits const&);
+  ~BudgetScope();
+  BudgetScope(BudgetScope const&) = delete;
+  BudgetScope& operator=(BudgetScope const&) = delete;
+};
+
+// application の再帰の深さを数える。
+class DepthGuard {
+public:
+  DepthGuard() {
+    if(--budget::current.depth_left < 0) {
+      ++budget::current.depth_left;
+      budget::too_deep();
+    }
+  }
+  ~DepthGuard() {
+    ++budget::current.depth_left;
+  }
+  DepthGuard(DepthGuard const&) = delete;
+  DepthGuard& operator=(DepthGuard const&) = delete;
+};
@@ -0,0 +1,248 @@
+#include "closure.hpp"
+#include "eval.hpp"
+#include "feedback.hpp"
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+struct FreeVariables {
+  // defmacro を含むなど、静的に解析できない
+  bool dynamic{};
+  std::vector<std::string> names;
+  // 本体で define される名前。作成時に未束縛でも構わない
+  std::unordered_set<std::string> defined;
+};
+
+class Analyzer {
+  FreeVariables& result;
+  std::vector<std::unordered_set<std::string>> scopes;
+  std::unordered_set<std::string> seen;
+
+  bool bound(std::string const& name) const {
+    for(auto const& scope: scopes) {
+      if(scope.count(name)) return true;
+    }
+    return false;
+  }
+
+  void reference(char const* name) {
+    if(bound(name) || !seen.insert(name).second) return;
+    result.names.emplace_back(name);
+  }
+
+  void bind_params(SExp params) {
+    auto& scope = scopes.back();
+    for(; !atomp(params); params = cdr(params)) {
+      if(symbolp(car(params))) scope.insert(cast<Tag::Symbol>(car(params)));
+    }
+    if(symbolp(params)) scope.insert(cast<Tag::Symbol>(params));
+  }
+
+  void walk_list(SExp list) {
+    for(; !atomp(list); list = cdr(list)) {
+      walk(car(list));
+    }
+  }
+
+  // let / let* / do。let と do の init は束縛の外側で、let* の init は先に束縛した名前を見る。
+  // do の step は内側で評価される。
+  void walk_binding_form(char const* name, SExp bindings, SExp body) {
+    bool sequential = !std::strcmp(name, "let*");
+    bool loop = !std::strcmp(name, "do");
+    if(!sequential) {
+      for(auto b = bindings; !atomp(b); b = cdr(b)) {
+        if(!atomp(car(b)) && !atomp(cdr(car(b)))) walk(car(cdr(car(b))));
+      }
+    }
+    scopes.emplace_back();
+    for(auto b = bindings; !atomp(b); b = cdr(b)) {
+      auto binding = car(b);
+      if(atomp(binding)) continue;
+      if(sequential && !atomp(cdr(binding))) walk(car(cdr(binding)));
+      if(symbolp(car(binding))) scopes.back().insert(cast<Tag::Symbol>(car(binding)));
+    }
+    if(loop) {
+      for(auto b = bindings; !atomp(b); b = cdr(b)) {
+        if(!atomp(car(b)) && !atomp(cdr(car(b)))) walk_list(cdr(cdr(car(b))));
+      }
+    }
+    walk_list(body);
+    scopes.pop_back();
+  }
+
+public:
+  Analyzer(FreeVariables& r) : result{r} {}
+
+  // form は (args body...)
+  void walk_lambda(SExp form) {
+    scopes.emplace_back();
+    bind_params(car(form));
+    walk_list(cdr(form));
+    scopes.pop_back();
+  }
+
+  void walk(SExp sexp) {
+    if(symbolp(sexp)) {
+      reference(cast<Tag::Symbol>(sexp));
+      return;
+    }
+    if(atomp(sexp)) return;
+    auto head = car(sexp);
+    auto rest = cdr(sexp);
+    char const* name = nullptr;
+    if(sitep(head)) {
+      auto site = cast<Tag::Site>(head);
+      if(site->kind == SiteKind::Lambda) {
+        reference(cast<Tag::Symbol>(site->symbol));
+        walk_list(rest);
+        return;
+      }
+      name = cast<Tag::Symbol>(site->symbol);
+    } else if(symbolp(head)) {
+      name = cast<Tag::Symbol>(head);
+    }
+    if(name == nullptr) {
+      walk(head);
+      walk_list(rest);
+      return;
+    }
+    if(primitivep(name)) {
+      walk_list(rest);
+      return;
+    }
+    if(!specialformp(name)) {
+      reference(name);
+      walk_list(rest);
+      return;
+    }
+    if(!std::strcmp(name, "quote")) return;
+    if(!std::strcmp(name, "defmacro")) {
+      result.dynamic = true;
+      return;
+    }
+    if(!std::strcmp(name, "lambda")) {
+      if(!atomp(rest)) walk_lambda(rest);
+      return;
+    }
+    if(!std::strcmp(name, "let") || !std::strcmp(name, "let*") || !std::strcmp(name, "do")) {
+      if(atomp(rest)) return;
+      walk_binding_form(name, car(rest), cdr(rest));
+      return;
+    }
+    if(!std::strcmp(name, "define") && !atomp(rest) && symbolp(car(rest))) {
+      // 本体の途中で define された名前も、それより前では外側を指しうるので自由変数に残す。
+      auto defined = cast<Tag::Symbol>(car(rest));
+      result.defined.insert(defined);
+      reference(defined);
+      walk_list(cdr(rest));
+      return;
+    }
+    walk_list(rest);
+  }
+};
+
+// 解析結果は lambda 式の cell ごとに一度だけ求める。
+FreeVariables const& analyze(SExp form) {
+  static std::unordered_map<SExp_ const*, FreeVariables> cache;
+  auto key = form.operator->();
+  auto it = cache.find(key);
+  if(it != end(cache)) return it->second;
+  FreeVariables result;
+  Analyzer{result}.walk_lambda(form);
+  return cache.emplace(key, std::move(result)).first->second;
+}
+
+// 局所 frame の本体が define しうる名前。lambda の本体は別の frame になるので見ない。
+struct Defines {
+  // defmacro を含むので、何を define するか分からない
+  bool any{};
+  std::unordered_set<std::string> names;
+  // primitive でも special form でもない呼び出しの先頭。macro なら展開先で何でも define しうる。
+  std::unordered_set<std::string> heads;
+};
+
+void collect_defines(SExp sexp, Defines& result) {
+  if(atomp(sexp)) return;
+  auto head = car(sexp);
+  char const* name = nullptr;
+  if(sitep(head)) {
+    name = cast<Tag::Symbol>(cast<Tag::Site>(head)->symbol);
+  } else if(symbolp(head)) {
+    name = cast<Tag::Symbol>(head);
+  }
+  if(name != nullptr && !specialformp(name) && !primitivep(name)) {
+    result.heads.insert(name);
+  }
+  if(name != nullptr && specialformp(name)) {
+    if(!std::strcmp(name, "quote") || !std::strcmp(name, "lambda")) return;
+    if(!std::strcmp(name, "defmacro")) {
+      result.any = true;
+      return;
+    }
+    if(!std::strcmp(name, "define") && !atomp(cdr(sexp)) && symbolp(car(cdr(sexp)))) {
+      result.names.insert(cast<Tag::Symbol>(car(cdr(sexp))));
+    }
+  }
+  for(; !atomp(sexp); sexp = cdr(sexp)) {
+    collect_defines(car(sexp), result);
+  }
+}
+
+// env は closure を作る位置の環境。本体が呼ぶ名前が macro かどうかはそこで引く。
+bool may_define(Env env, SExp body, std::string const& name) {
+  static std::unordered_map<SExp_ const*, Defines> cache;
+  auto key = body.operator->();
+  auto it = cache.find(key);
+  if(it == end(cache)) {
+    Defines result;
+    for(auto forms = body; !atomp(forms); forms = cdr(forms)) {
+      collect_defines(car(forms), result);
+    }
+    it = cache.emplace(key, std::move(result)).first;
+  }
+  auto const& defines = it->second;
+  if(defines.any || defines.names.count(name)) return true;
+  for(auto const& head: defines.heads) {
+    SExp value = nil;
+    if(resolve(env, head, value) != Binding::Unbound && macrop(value)) return true;
+  }
+  return false;
+}
+
+}
+
+Env closure_env(Env env, SExp form) {
+  auto const& free = analyze(form);
+  if(free.dynamic) return capture(env);
+  std::vector<std::pair<char const*, SExp>> captured;
+  for(auto const& name: free.names) {
+    // 囲む本体が後でこの名前を define するなら、今の束縛を写すと古い値を指してしまう。
+    auto defines = [&](SExp body, std::string const& sym) { return may_define(env, body, sym); };
+    if(rebindable(env, name, defines)) return capture(env);
+    SExp value = nil;
+    switch(resolve(env, name, value)) {
+    case Binding::Unbound:
+      if(!free.defined.count(name)) return capture(env);
+      break;
+    case Binding::Toplevel:
+      if(macrop(value)) return capture(env);
+      break;
+    case Binding::Local:
+      if(macrop(value)) return capture(env);
+      captured.emplace_back(name.c_str(), value);
+      break;
+    }
+  }
+  auto toplevel = toplevel_of(env);
+  if(captured.empty()) return toplevel;
+  auto closure = expand_env(toplevel);
+  for(auto const& [name, value]: captured) {
+    insert(closure, name, value);
+  }
+  return closure;
+}
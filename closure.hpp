@@ -0,0 +1,23 @@
+#pragma once
+
+#include "env.hpp"
+#include "sexp.hpp"
+
+// lambda が閉じ込める環境。
+//
+// lambda を作るたびに定義位置の環境をまるごと掴むと、呼び出しの frame の連鎖が
+// closure の寿命だけ生き残る。そこで lambda の本体を一度だけ走査して自由変数を求め、
+// 作成時に局所 frame で束縛されている自由変数だけを新しい frame に写す。その frame の
+// 親は最も近い toplevel なので、toplevel の名前はこれまでどおり引ける。
+// define は既存の束縛を上書きしないので、値を写しても共有した場合と区別はつかない。
+//
+// 次の場合は静的に決められないので、従来どおり env をそのまま掴む。
+// - 本体が defmacro を含むか、macro を呼んでいる
+// - 自由変数が作成時にまだ束縛されておらず、本体の define でもない (後から局所 frame に
+//   define される名前、たとえば局所関数の再帰)
+// - 自由変数の今の束縛より近い局所 frame の本体が、その名前を define している (局所関数が
+//   toplevel の同名の関数を後から隠す場合など)。その本体が macro を呼んでいるときも、
+//   展開先で何を define するか分からないので同じ扱い
+
+// (lambda args body...) の args 以降を form として受け取る。
+Env closure_env(Env env, SExp form);
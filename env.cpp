@@ -1,18 +1,40 @@
 #include "env.hpp"
+#include "budget.hpp"
 #include "exceptions.hpp"
 #include "sexp.hpp"
 
+#include <functional>
 #include <map>
 
 class Env_ {
   std::map<std::string, SExp> map;
   Env_ const* parent;
+  bool toplevel;
+  // 局所 frame を作った本体。本体が後から define する名前を調べるのに使う。
+  SExp_ const* origin{};
+  // closure や promise がこの frame を掴んだ。do はこれを見て frame を作り直す。
+  mutable bool captured{};
 public:
-  Env_() : parent{nullptr} {
+  Env_() : parent{nullptr}, toplevel{true} {
     map["#t"] = TRUE;
     map["#f"] = FALSE;
   }
-  Env_(Env_ const* p) : map{}, parent{p} {}
+  Env_(Env_ const* p, bool t = false) : map{}, parent{p}, toplevel{t} {}
+  Env_ const* toplevel_frame() const {
+    auto e = this;
+    while(!e->toplevel) e = e->parent;
+    return e;
+  }
+  Binding resolve(std::string const& sym, SExp& value) const {
+    for(auto e = this; e != nullptr; e = e->parent) {
+      auto it = e->map.find(sym);
+      if(it != end(e->map)) {
+        value = it->second;
+        return e->toplevel ? Binding::Toplevel : Binding::Local;
+      }
+    }
+    return Binding::Unbound;
+  }
   SExp lookup(std::string const& sym) const {
     auto it = map.find(sym);
     if(it != end(map)) {
@@ -23,9 +45,35 @@ public:
     }
     raise_with_str(UnboundVariableException, sym);
   }
+  // sym の今の束縛より近い局所 frame のどれかで、may_define が真になるか。
+  bool rebindable(std::string const& sym, std::function<bool(SExp, std::string const&)> const& may_define) const {
+    for(auto e = this; e != nullptr && !e->toplevel; e = e->parent) {
+      if(e->map.count(sym)) return false;
+      if(e->origin != nullptr && may_define(const_cast<SExp_*>(e->origin), sym)) return true;
+    }
+    return false;
+  }
+  void capture() const {
+    for(auto e = this; e != nullptr && !e->toplevel && !e->captured; e = e->parent) {
+      e->captured = true;
+    }
+  }
+  bool is_captured() const {
+    return captured;
+  }
+  void set_origin(SExp body) {
+    origin = body.operator->();
+  }
   void insert(std::string const& sym, SExp sexp) {
     map.insert(std::make_pair(sym, sexp));
   }
+  void assign(std::string const& sym, SExp sexp) {
+    auto it = map.find(sym);
+    if(it == end(map)) {
+      raise_with_str(UnboundVariableException, sym);
+    }
+    it->second = sexp;
+  }
 };
 
 Env::Env() {
@@ -37,13 +85,50 @@ Env empty_env() {
 }
 
 Env expand_env(Env env) {
+  budget::charge(sizeof(Env_), heap_profile::Kind::Env);
   return new Env_{env._env};
 }
 
+Env toplevel_env(Env parent) {
+  budget::charge(sizeof(Env_), heap_profile::Kind::Env);
+  return new Env_{parent.operator->(), true};
+}
+
+Env toplevel_of(Env env) {
+  return const_cast<Env_*>(env->toplevel_frame());
+}
+
+Binding resolve(Env env, std::string const& sym, SExp& value) {
+  return env->resolve(sym, value);
+}
+
 SExp lookup_symbol(Env env, std::string const& sym) {
   return env->lookup(sym);
 }
 
 void insert(Env env, std::string sym, SExp sexp) {
+  // std::map のノード 1 つ分のおおよその大きさ。
+  budget::charge(sizeof(std::string) + sizeof(SExp) + 4 * sizeof(void*), heap_profile::Kind::Binding);
   env->insert(sym, sexp);
 }
+
+void assign(Env env, std::string const& sym, SExp sexp) {
+  env->assign(sym, sexp);
+}
+
+void set_origin(Env env, SExp body) {
+  env->set_origin(body);
+}
+
+bool rebindable(Env env, std::string const& sym, std::function<bool(SExp, std::string const&)> const& may_define) {
+  return env->rebindable(sym, may_define);
+}
+
+Env capture(Env env) {
+  env->capture();
+  return env;
+}
+
+bool captured(Env env) {
+  return env->is_captured();
+}
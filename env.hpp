@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <string>
 
 class SExp;
@@ -18,7 +19,29 @@ public:
   }
 };
 
+// 環境には、script やプレリュードの最上位 (toplevel) と、lambda の呼び出しごとの frame がある。
+enum class Binding {
+  Unbound,
+  Toplevel,
+  Local,
+};
+
 Env expand_env(Env env);
 Env empty_env();
+Env toplevel_env(Env parent);
+// env から親をたどって最初に出会う toplevel。
+Env toplevel_of(Env env);
+// sym の束縛を探し、見つかれば value に入れて、それがどこにあったかを返す。
+Binding resolve(Env env, std::string const& sym, SExp& value);
 SExp lookup_symbol(Env env, std::string const& sym);
 void insert(Env env, std::string sym, SExp sexp);
+// env の frame 自身にある sym の束縛を書き換える。frame は確保しない。
+void assign(Env env, std::string const& sym, SExp sexp);
+// closure や promise が env をそのまま掴むときに呼ぶ。toplevel までの局所 frame に印を付ける。
+Env capture(Env env);
+bool captured(Env env);
+// 局所 frame を作った本体 (lambda の本体や let の form) を覚えておく。
+void set_origin(Env env, SExp body);
+// env から sym を引いた結果が、後の define で変わりうるか。今の束縛より近い局所 frame の
+// うち、origin について may_define(origin, sym) が真になるものがあれば真。
+bool rebindable(Env env, std::string const& sym, std::function<bool(SExp, std::string const&)> const& may_define);
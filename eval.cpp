@@ -1,99 +1,171 @@
 #include "eval.hpp"
-#include "utils.hpp"
 #include "exceptions.hpp"
 #include "parse.hpp"
 #include "prelude.hpp"
+#include "budget.hpp"
+#include "task.hpp"
+#include "arguments.hpp"
+#include "binary.hpp"
+#include "feedback.hpp"
+#include "primitive.hpp"
+#include "lists.hpp"
+#include "closure.hpp"
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
 #include <tuple>
+#include <unordered_map>
 #include <cstring>
 
 Env const default_env = prelude();
 
-std::pair<Env, SExp> eval_list(Env env, SExp sexp) {
-  if(null(sexp)) return std::make_pair(env, nil);
-  auto e = eval(env, car(sexp));
-  auto tail = eval_list(e.first, cdr(sexp));
-  return std::make_pair(tail.first, cons(e.second, tail.second));
+SExp list(Args args) {
+  return make_list(args.data, args.size);
 }
 
-SExp eval_cons(SExp sexp) {
-  auto invalid = [&](){ raise_with_str(ConsInvalidApplicationException, show(sexp)); };
-  if(null(sexp)) invalid();
-  auto car_ = car(sexp);
-  auto cdr_ = cdr(sexp);
-  if(null(cdr_)) invalid();
-  auto cadr = car(cdr_);
-  auto cddr = cdr(cdr_);
-  if(!null(cddr)) invalid();
-  return cons(car_, cadr);
+SExp eval_cons(Args args) {
+  if(args.size != 2) {
+    raise_with_str(ConsInvalidApplicationException, show(list(args)));
+  }
+  return cons(args[0], args[1]);
 }
 
-SExp eval_car(SExp sexp) {
-  return car(car(sexp));
+SExp eval_car(Args args) {
+  return car(args[0]);
 }
-SExp eval_cdr(SExp sexp) {
-  return cdr(car(sexp));
+SExp eval_cdr(Args args) {
+  return cdr(args[0]);
 }
-SExp eval_atom(SExp sexp) {
-  return atomp(car(sexp)) ? TRUE : FALSE;
+SExp eval_atom(Args args) {
+  return atomp(args[0]) ? TRUE : FALSE;
 }
-SExp eval_eq(SExp sexp) {
-  auto car_ = car(sexp);
-  auto cdr_ = cdr(sexp);
-  auto cadr = car(cdr_);
-  return eq(car_, cadr);
+SExp eval_eq(Args args) {
+  return eq(args[0], args[1]);
+}
+SExp eval_equal(Args args) {
+  return equal(args[0], args[1]);
 }
 
-SExp eval_add(SExp sexp, int diff) {
-  sexp = car(sexp);
+SExp eval_add(Args args, int diff) {
+  auto sexp = args[0];
   assert(integerp(sexp));
   return make_Integer(cast<Tag::Integer>(sexp) + diff);
 }
+SExp eval_inc(Args args) {
+  return eval_add(args, 1);
+}
+SExp eval_dec(Args args) {
+  return eval_add(args, -1);
+}
 
-SExp eval_sign(SExp sexp) {
-  sexp = car(sexp);
+SExp eval_sign(Args args) {
+  auto sexp = args[0];
   assert(integerp(sexp));
   int d = cast<Tag::Integer>(sexp);
   int sign = d < 0 ? -1 : (d != 0);
   return make_Integer(sign);
 }
 
-[[noreturn]] void fail(SExp sexp) {
-  std::cerr << "*** fail *** " << show(sexp) << std::endl;
+SExp eval_spawn(Args args) {
+  return spawn(args[0]);
+}
+
+SExp eval_yield(Args) {
+  yield();
+  return nil;
+}
+
+SExp eval_make_channel(Args) {
+  return make_channel();
+}
+
+SExp eval_send(Args args) {
+  send(args[0], args[1]);
+  return args[1];
+}
+
+SExp eval_receive(Args args) {
+  return receive(args[0]);
+}
+
+std::string path(SExp sexp) {
+  if(stringp(sexp)) return cast<Tag::String>(sexp);
+  if(symbolp(sexp)) return cast<Tag::Symbol>(sexp);
+  raise_with_str(InvalidApplicationException, show(sexp));
+}
+
+SExp eval_write_binary(Args args) {
+  write_binary(path(args[0]), args[1]);
+  return args[1];
+}
+
+SExp eval_read_binary(Args args) {
+  return read_binary(path(args[0]));
+}
+
+[[noreturn]] SExp fail(Args args) {
+  std::cerr << "*** fail *** " << show(list(args)) << std::endl;
   raise(FailException);
 }
 
-SExp eval_primitive(std::string prim, SExp sexp) {
-  if(prim == "cons") {
-    return eval_cons(sexp);
-  }
-  if(prim == "car") {
-    return eval_car(sexp);
-  }
-  if(prim == "cdr") {
-    return eval_cdr(sexp);
-  }
-  if(prim == "atom") {
-    return eval_atom(sexp);
-  }
-  if(prim == "eq") {
-    return eval_eq(sexp);
-  }
-  if(prim == "inc") {
-    return eval_add(sexp, 1);
-  }
-  if(prim == "dec") {
-    return eval_add(sexp, -1);
-  }
-  if(prim == "sign") {
-    return eval_sign(sexp);
-  }
-  if(prim == "fail") {
-    fail(sexp);
+// 組み込みの primitive で始め、埋め込む側の登録を後ろに足す。
+// default_env の初期化中にも引かれるので、最初に使うときに作る。
+// call site が要素を指すので、足しても動かない deque に置く。
+std::deque<Primitive>& registry() {
+  static std::deque<Primitive> primitives{
+    {"cons", 2, NoFlags, eval_cons, {}},
+    {"car", 1, Pure | NoAlloc, eval_car, {}},
+    {"cdr", 1, Pure | NoAlloc, eval_cdr, {}},
+    {"atom", 1, Pure | NoAlloc, eval_atom, {}},
+    {"eq", 2, Pure | NoAlloc, eval_eq, {}},
+    {"equal", 2, Pure | NoAlloc, eval_equal, {}},
+    {"fail", variadic, NoFlags, fail, {}},
+    {"inc", 1, Pure, eval_inc, {}},
+    {"dec", 1, Pure, eval_dec, {}},
+    {"sign", 1, Pure, eval_sign, {}},
+    {"spawn", 1, NoFlags, eval_spawn, {}},
+    {"yield", 0, NoFlags, eval_yield, {}},
+    {"make-channel", 0, NoFlags, eval_make_channel, {}},
+    {"send", 2, NoFlags, eval_send, {}},
+    {"receive", 1, NoFlags, eval_receive, {}},
+    {"write-binary", 2, NoFlags, eval_write_binary, {}},
+    {"read-binary", 1, NoFlags, eval_read_binary, {}},
+    {"length", 1, Pure, eval_length, {}},
+    {"append", variadic, NoFlags, eval_append, {}},
+    {"reverse", 1, NoFlags, eval_reverse, {}},
+    {"nth", 2, Pure | NoAlloc, eval_nth, {}},
+    {"map", 2, NoFlags, eval_map, {}},
+    {"filter", 2, NoFlags, eval_filter, {}},
+    {"foldl", 3, NoFlags, eval_foldl, {}},
+    {"foldr", 3, NoFlags, eval_foldr, {}},
+    {"assoc", 2, Pure | NoAlloc, eval_assoc, {}},
+    {"member", 2, Pure | NoAlloc, eval_member, {}},
+    {"stream-map", 2, NoFlags, eval_stream_map, {}},
+    {"stream-filter", 2, NoFlags, eval_stream_filter, {}},
+    {"stream-take", 2, NoFlags, eval_stream_take, {}},
+  };
+  return primitives;
+}
+
+
+Primitive const* find_primitive(char const* name) {
+  for(auto const& prim: registry()) {
+    if(prim.name == name) return &prim;
   }
+  return nullptr;
+}
 
-  raise(NeverComeException);
+// 実引数を順に評価して buf に積む。
+Env eval_args(Env env, SExp sexp, ArgBuffer& buf) {
+  while(!null(sexp)) {
+    // SExp のデフォルトコンストラクタは cell を確保するので、受け皿を作らない。
+    auto r = eval(env, car(sexp));
+    env = r.first;
+    buf.push_back(r.second);
+    sexp = cdr(sexp);
+  }
+  return env;
 }
 
 std::pair<Env, SExp> eval_if(Env env, SExp sexp) {
@@ -112,6 +184,15 @@ std::pair<Env, SExp> eval_if(Env env, SExp sexp) {
   }
 }
 
+// primitive と special form は環境より先に名前で引かれるので、define しても呼ばれない。
+// 黙って無視せずに例外にする。
+void check_definable(SExp sym) {
+  auto name = cast<Tag::Symbol>(sym);
+  if(primitivep(name) || specialformp(name)) {
+    raise_with_str(DefineInvalidApplicationException, std::string{"cannot redefine a builtin: "} + name);
+  }
+}
+
 std::pair<Env, SExp> eval_define(Env env, SExp sexp) {
   auto sym = car(sexp);
   auto val = car(cdr(sexp));
@@ -120,7 +201,11 @@ std::pair<Env, SExp> eval_define(Env env, SExp sexp) {
   if(!null(cddr)) {
     raise_with_str(DefineInvalidApplicationException, show(sexp));
   }
+  check_definable(sym);
   auto v = eval(env, val);
+  if(lambdap(v.second)) {
+    name_lambda(v.second, cast<Tag::Symbol>(sym));
+  }
   insert(env, cast<Tag::Symbol>(sym), v.second);
   return std::make_pair(env, sym);
 }
@@ -128,67 +213,226 @@ std::pair<Env, SExp> eval_define(Env env, SExp sexp) {
 std::pair<Env, SExp> eval_lambda(Env env, SExp sexp) {
   auto args = car(sexp);
   auto body = cdr(sexp);
-  return std::make_pair(env, make_Lambda(env, args, body));
+  return std::make_pair(env, make_Lambda(closure_env(env, sexp), args, body));
 }
 
 std::pair<Env, SExp> eval_macro(Env env, SExp sexp) {
   auto sym = car(sexp);
   assert(symbolp(sym));
+  check_definable(sym);
   auto args = car(cdr(sexp));
   auto body = car(cdr(cdr(sexp)));
-  insert(env, cast<Tag::Symbol>(sym), make_Macro(env, args, body));
+  insert(env, cast<Tag::Symbol>(sym), make_Macro(capture(env), args, body));
   return std::make_pair(env, sym);
 }
 
-std::pair<Env, SExp> eval_specialforms(std::string form, Env env, SExp sexp) {
-  if(form == "if") {
-    return eval_if(env, sexp); 
-  }
-  if(form == "define") {
-    return eval_define(env, sexp);
+std::pair<Env, SExp> eval_delay(Env env, SExp sexp) {
+  return std::make_pair(env, make_Promise(capture(env), car(sexp)));
+}
+
+std::pair<Env, SExp> eval_force(Env env, SExp sexp) {
+  auto r = eval(env, car(sexp));
+  return std::make_pair(r.first, force(r.second));
+}
+
+// (stream-cons a b) は (cons a (delay b))。
+std::pair<Env, SExp> eval_stream_cons(Env env, SExp sexp) {
+  auto r = eval(env, car(sexp));
+  env = r.first;
+  return std::make_pair(env, cons(r.second, make_Promise(capture(env), car(cdr(sexp)))));
+}
+
+SExp eval_body(Env lambda_env, SExp body_);
+
+// (let ((name init)...) body...)。init を外側で評価し、1 つの frame に束縛する。
+std::pair<Env, SExp> eval_let(Env env, SExp sexp) {
+  if(atomp(sexp)) {
+    raise_with_str(LetInvalidApplicationException, show(sexp));
+  }
+  auto frame = expand_env(env);
+  set_origin(frame, cdr(sexp));
+  for(auto bindings = car(sexp); !null(bindings); bindings = cdr(bindings)) {
+    auto binding = car(bindings);
+    if(atomp(binding) || !symbolp(car(binding)) || atomp(cdr(binding)) || !null(cdr(cdr(binding)))) {
+      raise_with_str(LetInvalidApplicationException, show(sexp));
+    }
+    insert(frame, cast<Tag::Symbol>(car(binding)), eval(env, car(cdr(binding))).second);
   }
-  if(form == "lambda") {
-    return eval_lambda(env, sexp);
+  return std::make_pair(env, eval_body(frame, cdr(sexp)));
+}
+
+// (let* ((name init)...) body...)。init は先に束縛した名前を見る。
+// 同じ名前がもう一度現れたときだけ frame を足す。insert は上書きしないので。
+std::pair<Env, SExp> eval_let_star(Env env, SExp sexp) {
+  if(atomp(sexp)) {
+    raise_with_str(LetInvalidApplicationException, show(sexp));
+  }
+  auto frame = expand_env(env);
+  set_origin(frame, sexp);
+  std::vector<char const*> names;
+  for(auto bindings = car(sexp); !null(bindings); bindings = cdr(bindings)) {
+    auto binding = car(bindings);
+    if(atomp(binding) || !symbolp(car(binding)) || atomp(cdr(binding)) || !null(cdr(cdr(binding)))) {
+      raise_with_str(LetInvalidApplicationException, show(sexp));
+    }
+    auto name = cast<Tag::Symbol>(car(binding));
+    auto value = eval(frame, car(cdr(binding))).second;
+    if(std::any_of(begin(names), end(names), [&](char const* n){ return !std::strcmp(n, name); })) {
+      frame = expand_env(frame);
+      set_origin(frame, sexp);
+      names.clear();
+    }
+    insert(frame, name, value);
+    names.push_back(name);
   }
-  if(form == "quote") {
-    return std::make_pair(env, sexp);
+  return std::make_pair(env, eval_body(frame, cdr(sexp)));
+}
+
+// (do ((name init step)...) (test result...) body...) を一度だけ分解したもの。
+struct Loop {
+  struct Var {
+    std::string name;
+    SExp init;
+    SExp step;
+    bool stepped;
+  };
+  std::vector<Var> vars;
+  SExp test;
+  SExp result;
+  SExp body;
+};
+
+Loop const& parse_loop(SExp sexp) {
+  static std::unordered_map<SExp_ const*, Loop> cache;
+  auto it = cache.find(sexp.operator->());
+  if(it != end(cache)) return it->second;
+  auto invalid = [&](){ raise_with_str(DoInvalidApplicationException, show(sexp)); };
+  if(atomp(sexp) || atomp(cdr(sexp)) || atomp(car(cdr(sexp)))) invalid();
+  Loop loop{{}, car(car(cdr(sexp))), cdr(car(cdr(sexp))), cdr(cdr(sexp))};
+  for(auto vars = car(sexp); !null(vars); vars = cdr(vars)) {
+    if(atomp(vars)) invalid();
+    auto var = car(vars);
+    if(atomp(var) || !symbolp(car(var)) || atomp(cdr(var))) invalid();
+    auto step = cdr(cdr(var));
+    if(!null(step) && (atomp(step) || !null(cdr(step)))) invalid();
+    loop.vars.push_back({cast<Tag::Symbol>(car(var)), car(cdr(var)), null(step) ? nil : car(step), !null(step)});
+  }
+  return cache.emplace(sexp.operator->(), std::move(loop)).first->second;
+}
+
+// 変数は 1 つの frame に置いたまま、step の値をすべて求めてから書き換える。
+// 繰り返しごとに環境を確保せず、native stack も積まない。
+// ただし、その回の frame を closure や promise が掴んでいたら、書き換えずに新しい frame に
+// 束縛し直す。値を写す closure と frame を掴む closure が同じ値を見るように。
+std::pair<Env, SExp> eval_do(Env env, SExp sexp) {
+  auto const& loop = parse_loop(sexp);
+  auto frame = expand_env(env);
+  set_origin(frame, sexp);
+  for(auto const& var: loop.vars) {
+    insert(frame, var.name, eval(env, var.init).second);
+  }
+  std::vector<SExp> next(loop.vars.size(), nil);
+  while(!to_bool(eval(frame, loop.test).second)) {
+    eval_body(frame, loop.body);
+    for(size_t i{}; i < loop.vars.size(); ++i) {
+      if(loop.vars[i].stepped) next[i] = eval(frame, loop.vars[i].step).second;
+    }
+    if(captured(frame)) {
+      auto fresh = expand_env(env);
+      set_origin(fresh, sexp);
+      for(size_t i{}; i < loop.vars.size(); ++i) {
+        auto const& var = loop.vars[i];
+        insert(fresh, var.name, var.stepped ? next[i] : lookup_symbol(frame, var.name));
+      }
+      frame = fresh;
+      continue;
+    }
+    for(size_t i{}; i < loop.vars.size(); ++i) {
+      if(loop.vars[i].stepped) assign(frame, loop.vars[i].name, next[i]);
+    }
   }
-  if(form == "defmacro") {
-    return eval_macro(env, sexp);
+  return std::make_pair(env, eval_body(frame, loop.result));
+}
+
+std::pair<Env, SExp> eval_quote(Env env, SExp sexp) {
+  return std::make_pair(env, sexp);
+}
+
+struct SpecialForm {
+  char const* name;
+  SpecialFormFn fn;
+};
+
+SpecialForm const specialforms[] = {
+  {"if", eval_if},
+  {"define", eval_define},
+  {"defmacro", eval_macro},
+  {"quote", eval_quote},
+  {"lambda", eval_lambda},
+  {"delay", eval_delay},
+  {"force", eval_force},
+  {"stream-cons", eval_stream_cons},
+  {"let", eval_let},
+  {"let*", eval_let_star},
+  {"do", eval_do},
+};
+
+SpecialForm const* find_specialform(char const* name) {
+  for(auto const& form: specialforms) {
+    if(!std::strcmp(form.name, name)) return &form;
   }
-  raise(NeverComeException);
+  return nullptr;
 }
 
-SExp reverse_impl(SExp list, SExp result) {
-  if(null(list)) return result;
-  return reverse_impl(cdr(list), cons(car(list), result));
+void register_primitive(Primitive primitive) {
+  // primitive は環境より先に名前で引かれるので、prelude の関数と同じ名前だとそれを黙って隠してしまう。
+  SExp bound = nil;
+  if(find_primitive(primitive.name.c_str()) || find_specialform(primitive.name.c_str())
+      || resolve(default_env, primitive.name, bound) != Binding::Unbound) {
+    raise_with_str(InvalidApplicationException, "already defined: " + primitive.name);
+  }
+  registry().push_back(std::move(primitive));
 }
-SExp reverse(SExp list) {
-  return reverse_impl(list, nil);
+
+void arity_mismatch(Primitive const& primitive, Args args) {
+  raise_with_str(InvalidApplicationException, primitive.name + ": expected " + std::to_string(primitive.arity) + " arguments, got " + show(list(args)));
 }
 
-SExp copy_list_impl(SExp list, SExp result) {
-  if(null(list)) return result;
-  return copy_list_impl(cdr(list), cons(car(list), result));
+bool primitivep(char const* name) {
+  return find_primitive(name) != nullptr;
 }
-SExp copy_list(SExp list) {
-  return reverse(copy_list_impl(list, nil));
+
+bool specialformp(char const* name) {
+  return find_specialform(name) != nullptr;
+}
+
+// 木の pair をすべて作り直す。atom は共有する。
+SExp copy_tree(SExp sexp) {
+  if(atomp(sexp)) return sexp;
+  std::vector<SExp> v;
+  auto l = sexp;
+  for(; !atomp(l); l = cdr(l)) {
+    v.push_back(copy_tree(car(l)));
+  }
+  return make_list(v.data(), v.size(), l);
 }
 
 SExp replace(char const* sym, SExp actual, SExp expanded);
+// 仮引数の出現ごとに実引数の複製を置く。評価器は式の先頭を CallSite に書き換えるので、
+// 式として評価される cell と (quote e) などで値として返る cell を共有してはいけない。
 SExp replace_impl(char const* sym, SExp actual, SExp expanded, SExp result) {
   if(null(expanded)) return result;
   auto it = car(expanded);
   if(symbolp(it)) {
     if(!std::strcmp(sym, cast<Tag::Symbol>(it))) {
-      return replace_impl(sym, actual, cdr(expanded), cons(actual, result));
+      return replace_impl(sym, actual, cdr(expanded), cons(copy_tree(actual), result));
     }
     return replace_impl(sym, actual, cdr(expanded), cons(it, result));
   }
   if(!atomp(it)) {
     return replace_impl(sym, actual, cdr(expanded), cons(replace(sym, actual, it), result));
   }
-  raise(NeverComeException);
+  return replace_impl(sym, actual, cdr(expanded), cons(it, result));
 }
 SExp replace(char const* sym, SExp actual, SExp expanded) {
   return reverse(replace_impl(sym, actual, expanded, nil));
@@ -208,49 +452,136 @@ SExp expand_macro(SExp macro, SExp args) {
   return expanded;
 }
 
-Env push_symbols(Env env, SExp dummies, SExp actuals) {
-  auto invalid = [&](){ raise_with_str(LambdaInvalidApplicationException, "dummies: " + show(dummies) + ", actuals: " + show(actuals)); };
-  if(null(dummies)) {
-    if(!null(actuals)) {
-      invalid();
-    }
+// 仮引数に実引数を直接束縛する。(lambda xs ...) のときだけリストを作る。
+Env push_symbols(Env env, SExp dummies, Args actuals) {
+  if(symbolp(dummies)) {
+    insert(env, cast<Tag::Symbol>(dummies), list(actuals));
     return env;
   }
-  auto dummy = car(dummies);
-  auto actual = car(actuals);
-  if(null(actual)) {
-    invalid();
+  auto invalid = [&](){ raise_with_str(LambdaInvalidApplicationException, "dummies: " + show(dummies) + ", actuals: " + show(list(actuals))); };
+  size_t i{};
+  for(; !null(dummies); dummies = cdr(dummies), ++i) {
+    auto dummy = car(dummies);
+    if(i >= actuals.size || !symbolp(dummy)) {
+      invalid();
+    }
+    insert(env, cast<Tag::Symbol>(dummy), actuals[i]);
   }
-  if(!symbolp(dummy)) {
+  if(i != actuals.size) {
     invalid();
   }
-  insert(env, cast<Tag::Symbol>(dummy), actual);
-  return push_symbols(env, cdr(dummies), cdr(actuals));
+  return env;
 }
 
-std::pair<Env, SExp> application(Env env_, SExp lambda, SExp args_) {
-  auto [outer_env, apply_args] = eval_list(env_, args_);
-  Env lambda_env = expand_env(env(lambda));
-  auto lambda_args = args(lambda);
-  if(symbolp(lambda_args)) {
-    insert(lambda_env, cast<Tag::Symbol>(lambda_args), apply_args);
-  } else {
-    lambda_env = push_symbols(lambda_env, lambda_args, apply_args);
-  }
-  auto body_ = body(lambda);
+SExp eval_body(Env lambda_env, SExp body_) {
   auto ret = nil;
   while(!null(body_)) {
     std::tie(lambda_env, ret) = eval(lambda_env, car(body_));
     body_ = cdr(body_);
   }
-  return std::make_pair(outer_env, ret);
+  return ret;
+}
+
+SExp apply(SExp lambda, Args apply_args) {
+  DepthGuard guard;
+  heap_profile::FunctionScope scope{lambda_name(lambda)};
+  Env lambda_env = push_symbols(expand_env(env(lambda)), args(lambda), apply_args);
+  set_origin(lambda_env, body(lambda));
+  return eval_body(lambda_env, body(lambda));
+}
+
+// 仮引数の検査を済ませた名前の並びで束縛する。CallSite が特殊化した呼び出しで使う。
+SExp apply(SExp lambda, std::vector<char const*> const& params, Args apply_args) {
+  DepthGuard guard;
+  heap_profile::FunctionScope scope{lambda_name(lambda)};
+  if(params.size() != apply_args.size) {
+    push_symbols(expand_env(env(lambda)), args(lambda), apply_args); // 引数の数の誤りを報告する
+  }
+  Env lambda_env = expand_env(env(lambda));
+  set_origin(lambda_env, body(lambda));
+  for(size_t i{}; i < params.size(); ++i) {
+    insert(lambda_env, params[i], apply_args[i]);
+  }
+  return eval_body(lambda_env, body(lambda));
+}
+
+SExp apply(SExp lambda, SExp apply_args) {
+  ArgBuffer buf;
+  for(; !null(apply_args); apply_args = cdr(apply_args)) {
+    buf.push_back(car(apply_args));
+  }
+  return apply(lambda, buf.args());
+}
+
+std::pair<Env, SExp> application(Env env_, SExp lambda, SExp args_) {
+  ArgBuffer buf;
+  auto outer_env = eval_args(env_, args_, buf);
+  return std::make_pair(outer_env, apply(lambda, buf.args()));
+}
+
+// 先頭が CallSite に書き換えられた呼び出しを評価する。
+std::pair<Env, SExp> eval_site(Env env, CallSite& site, SExp args_) {
+  switch(site.kind) {
+  case SiteKind::SpecialForm:
+    return site.special(env, args_);
+  case SiteKind::Primitive: {
+    if(site.state == SiteState::Constant) {
+      return std::make_pair(env, site.value);
+    }
+    ArgBuffer buf;
+    env = eval_args(env, args_, buf);
+    // eval_args で評価は終了しているので、その後envは変化しない。
+    auto a = buf.args();
+    if(site.state == SiteState::Specialized) {
+      if(guard(site, a)) {
+        return std::make_pair(env, site.fast(a));
+      }
+      deopt(site);
+    } else if(site.state == SiteState::Warmup) {
+      if(site.foldable) {
+        fold(site, call(*site.primitive, a));
+        return std::make_pair(env, site.value);
+      }
+      observe(site, a);
+    }
+    return std::make_pair(env, call(*site.primitive, a));
+  }
+  case SiteKind::Lambda: {
+    auto f = lookup_symbol(env, cast<Tag::Symbol>(site.symbol));
+    if(macrop(f)) {
+      return eval(env, expand_macro(f, args_));
+    }
+    if(!lambdap(f)) {
+      raise_with_str(InvalidApplicationException, show(f));
+    }
+    ArgBuffer buf;
+    auto outer_env = eval_args(env, args_, buf);
+    if(site.state == SiteState::Specialized) {
+      if(site.lambda == f) {
+        return std::make_pair(outer_env, apply(f, site.params, buf.args()));
+      }
+      deopt(site);
+    } else if(site.state == SiteState::Warmup) {
+      observe_lambda(site, f);
+    }
+    return std::make_pair(outer_env, apply(f, buf.args()));
+  }
+  }
+  raise(NeverComeException);
 }
 
 std::pair<Env, SExp> eval(Env env, SExp sexp) {
-  if(null(sexp) || integerp(sexp)) return std::make_pair(env, sexp);
+  budget::tick();
+  budget::check_stack();
+  sched::tick();
+  if(atomp(sexp) && !symbolp(sexp)) return std::make_pair(env, sexp);
   if(symbolp(sexp)) return std::make_pair(env, lookup_symbol(env, cast<Tag::Symbol>(sexp)));
+  heap_profile::FormScope form{sexp};
   auto car_ = car(sexp);
   auto cdr_ = cdr(sexp);
+  if(sitep(car_)) {
+    return eval_site(env, *cast<Tag::Site>(car_), cdr_);
+  }
   if(!atomp(car_)) {
     std::tie(env, car_) = eval(env, car_);
   }
@@ -258,17 +589,26 @@ std::pair<Env, SExp> eval(Env env, SExp sexp) {
     raise_with_str(InvalidApplicationException, show(car_));
   }
   if(symbolp(car_)) {
-    auto const primitives = std::experimental::make_array<std::string>("cons", "car", "cdr", "atom", "eq", "fail", "inc", "dec", "sign");
-    if(in<std::string>(cast<Tag::Symbol>(car_), primitives)) {
-      auto l = eval_list(env, cdr_);
-      // eval_list で評価は終了しているので、その後envは変化しない。
-      return std::make_pair(l.first, eval_primitive(cast<Tag::Symbol>(car_), l.second));
+    // 共有された定数を式として評価するときは、CallSite に書き換えない。
+    bool rewritable = !immutablep(sexp);
+    if(auto prim = find_primitive(cast<Tag::Symbol>(car_))) {
+      if(!rewritable) {
+        ArgBuffer buf;
+        env = eval_args(env, cdr_, buf);
+        return std::make_pair(env, call(*prim, buf.args()));
+      }
+      return eval_site(env, *install_primitive_site(sexp, *prim), cdr_);
     }
-    auto const specialforms = std::experimental::make_array<std::string>("if", "define", "defmacro", "quote", "lambda");
-    if(in<std::string>(cast<Tag::Symbol>(car_), specialforms)) {
-      return eval_specialforms(cast<Tag::Symbol>(car_), env, cdr_);
+    if(auto form = find_specialform(cast<Tag::Symbol>(car_))) {
+      if(!rewritable) {
+        return form->fn(env, cdr_);
+      }
+      return eval_site(env, *install_specialform_site(sexp, form->fn), cdr_);
     }
     std::tie(env, car_) = eval(env, car_);
+    if(lambdap(car_) && rewritable) {
+      return eval_site(env, *install_lambda_site(sexp), cdr_);
+    }
   }
   if(macrop(car_)) {
     return eval(env, expand_macro(car_, cdr_));
@@ -280,6 +620,23 @@ std::pair<Env, SExp> eval(Env env, SExp sexp) {
   raise(NeverComeException);
 }
 
+// 一度だけ評価し、その値を覚えておく。promise でなければそのまま返す。
+SExp force(SExp p) {
+  if(!promisep(p) || forced(p)) {
+    return promisep(p) ? promise_value(p) : p;
+  }
+  auto value = eval(promise_env(p), promise_expr(p)).second;
+  // 評価の途中で同じ promise が force されていたら、先に決まった値を使う。
+  if(!forced(p)) {
+    fulfill(p, value);
+  }
+  return promise_value(p);
+}
+
+Env prelude_frame() {
+  return expand_env(default_env);
+}
+
 SExp eval(SExp sexp) {
   auto r = eval(default_env, sexp);
   return r.second;
@@ -293,17 +650,27 @@ std::pair<Env, SExp> eval(Env env, std::vector<SExp> const& sexps) {
   return std::make_pair(env, ret);
 }
 
+Env script_env() {
+  return toplevel_env(default_env);
+}
+
 SExp eval(std::vector<SExp> const& sexps) {
   auto r = eval(default_env, sexps);
   return r.second;
 }
 
-[[noreturn]] void repl(std::istream& is) {
+[[noreturn]] void repl(std::istream& is, Limits const& limits) {
   auto env = default_env;
   while(true) {
     auto sexp = parse_SExpr(is);
-    std::tie(env, sexp) = eval(env, sexp);
-    std::cout << "#=> " << show(sexp) << std::endl;
+    try {
+      BudgetScope budget{limits};
+      std::tie(env, sexp) = eval(env, sexp);
+      run_tasks();
+      std::cout << "#=> " << show(sexp) << std::endl;
+    } catch(BudgetExceededException const& e) {
+      std::cout << "*** budget exceeded: " << e.str << " ***" << std::endl;
+    }
     skip_spaces(is);
   }
 }
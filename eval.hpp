@@ -4,10 +4,26 @@
 #include <vector>
 
 #include "sexp.hpp"
+#include "budget.hpp"
+#include "arguments.hpp"
 
 SExp eval(SExp);
 std::pair<Env, SExp> eval(Env, SExp);
 SExp eval(std::vector<SExp> const&);
 std::pair<Env, SExp> eval(Env, std::vector<SExp> const&);
+// 評価済みの引数のリストで lambda を呼ぶ。
+SExp apply(SExp lambda, SExp args);
+SExp apply(SExp lambda, Args args);
+// promise なら一度だけ評価してその値を、promise でなければそのまま返す。
+SExp force(SExp);
+// prelude の下に空の frame を 1 つ足した環境。native から Lisp の式を遅延させるときに使う。
+Env prelude_frame();
 
-[[noreturn]] void repl(std::istream&);
+// name が primitive / special form の名前か。これらは環境より先に名前で決まる。
+bool primitivep(char const* name);
+bool specialformp(char const* name);
+
+// prelude を親に持つ、script 用の新しい環境。
+Env script_env();
+
+[[noreturn]] void repl(std::istream&, Limits const& = Limits{});
@@ -33,6 +33,12 @@ struct DefineInvalidApplicationException : public InvalidApplicationException {
 struct LambdaInvalidApplicationException : public InvalidApplicationException {
   using InvalidApplicationException::InvalidApplicationException;
 };
+struct LetInvalidApplicationException : public InvalidApplicationException {
+  using InvalidApplicationException::InvalidApplicationException;
+};
+struct DoInvalidApplicationException : public InvalidApplicationException {
+  using InvalidApplicationException::InvalidApplicationException;
+};
 
 struct UnboundVariableException : public Exception {
   std::string const str;
@@ -43,6 +49,27 @@ struct FailException : public Exception {
   using Exception::Exception;
 };
 
+struct InvalidBinaryException : public Exception {
+  std::string const str;
+  InvalidBinaryException(std::string_view f, int l, std::string_view str_) : Exception{f, l}, str{str_} {}
+};
+
+struct DeadlockException : public Exception {
+  using Exception::Exception;
+};
+
+// str は最初に例外で終わった task とその理由。
+struct TaskFailedException : public Exception {
+  std::string const str;
+  TaskFailedException(std::string_view f, int l, std::string_view str_) : Exception{f, l}, str{str_} {}
+};
+
+// str は超過した資源の名前 (steps, heap, time, depth)。
+struct BudgetExceededException : public Exception {
+  std::string const str;
+  BudgetExceededException(std::string_view f, int l, std::string_view str_) : Exception{f, l}, str{str_} {}
+};
+
 template<typename T>
 [[noreturn]] void raise_(std::string_view file, int line) {
   throw T{file, line};
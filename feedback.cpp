@@ -0,0 +1,145 @@
+#include "feedback.hpp"
+#include "budget.hpp"
+#include "sexp_impl.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// 同じ観測がこの回数続いたら特殊化する。
+constexpr int warmup = 2;
+
+// 以下は guard で tag を確かめた後にだけ呼ばれるので、tag を見ない。
+SExp fast_inc(Args args) {
+  return make_Integer(args.data[0]->_value.integer + 1);
+}
+SExp fast_dec(Args args) {
+  return make_Integer(args.data[0]->_value.integer - 1);
+}
+SExp fast_sign(Args args) {
+  int d = args.data[0]->_value.integer;
+  return make_Integer(d < 0 ? -1 : (d != 0));
+}
+SExp fast_eq_integer(Args args) {
+  return args.data[0]->_value.integer == args.data[1]->_value.integer ? TRUE : FALSE;
+}
+SExp fast_eq_symbol(Args args) {
+  auto lhs = args.data[0]->_value.symbol;
+  auto rhs = args.data[1]->_value.symbol;
+  return lhs == rhs || !std::strcmp(lhs, rhs) ? TRUE : FALSE;
+}
+SExp fast_car(Args args) {
+  auto pair = args[0];
+  return pair_car(pair.operator->());
+}
+SExp fast_cdr(Args args) {
+  auto pair = args[0];
+  return pair_cdr(pair.operator->());
+}
+
+struct FastPath {
+  char const* name;
+  size_t arity;
+  Tag tags[2];
+  PrimitiveFn fn;
+};
+
+FastPath const fast_paths[] = {
+  {"inc", 1, {Tag::Integer}, fast_inc},
+  {"dec", 1, {Tag::Integer}, fast_dec},
+  {"sign", 1, {Tag::Integer}, fast_sign},
+  {"eq", 2, {Tag::Integer, Tag::Integer}, fast_eq_integer},
+  {"eq", 2, {Tag::Symbol, Tag::Symbol}, fast_eq_symbol},
+  {"car", 1, {Tag::Pair}, fast_car},
+  {"cdr", 1, {Tag::Pair}, fast_cdr},
+};
+
+PrimitiveFn find_fast_path(CallSite const& site) {
+  for(auto const& path: fast_paths) {
+    if(std::strcmp(path.name, cast<Tag::Symbol>(site.symbol))) continue;
+    if(path.arity != site.arity) continue;
+    if(std::equal(site.tags, site.tags + site.arity, path.tags)) return path.fn;
+  }
+  return nullptr;
+}
+
+// 評価しても環境を見ない式。記号でない atom と quote。
+bool literalp(SExp sexp) {
+  if(symbolp(sexp)) return false;
+  if(atomp(sexp)) return true;
+  auto head = car(sexp);
+  if(sitep(head)) head = cast<Tag::Site>(head)->symbol;
+  return symbolp(head) && !std::strcmp(cast<Tag::Symbol>(head), "quote");
+}
+
+CallSite* install(SExp form, SiteKind kind) {
+  budget::charge(sizeof(CallSite), heap_profile::Kind::CallSite);
+  auto site = new CallSite{}; // leak
+  site->symbol = car(form);
+  site->kind = kind;
+  site->state = SiteState::Warmup;
+  set_car(form, make_Site(site));
+  return site;
+}
+
+}
+
+CallSite* install_primitive_site(SExp form, Primitive const& primitive) {
+  auto site = install(form, SiteKind::Primitive);
+  site->primitive = &primitive;
+  site->foldable = primitive.flags & Pure;
+  for(auto args = cdr(form); site->foldable && !atomp(args); args = cdr(args)) {
+    site->foldable = literalp(car(args));
+  }
+  return site;
+}
+
+CallSite* install_specialform_site(SExp form, SpecialFormFn special) {
+  auto site = install(form, SiteKind::SpecialForm);
+  site->special = special;
+  site->state = SiteState::Generic;
+  return site;
+}
+
+CallSite* install_lambda_site(SExp form) {
+  return install(form, SiteKind::Lambda);
+}
+
+void observe(CallSite& site, Args args) {
+  if(args.size > 2) {
+    site.state = SiteState::Generic;
+    return;
+  }
+  if(site.hits > 0 && !guard(site, args)) {
+    site.state = SiteState::Generic;
+    return;
+  }
+  site.arity = args.size;
+  for(size_t i{}; i < args.size; ++i) {
+    site.tags[i] = type(args[i]);
+  }
+  if(++site.hits < warmup) return;
+  site.fast = find_fast_path(site);
+  site.state = site.fast != nullptr ? SiteState::Specialized : SiteState::Generic;
+}
+
+void observe_lambda(CallSite& site, SExp lambda) {
+  if(site.hits > 0 && !(site.lambda == lambda)) {
+    site.state = SiteState::Generic;
+    return;
+  }
+  site.lambda = lambda;
+  if(++site.hits < warmup) return;
+  // 仮引数が記号の並びなら、検査を済ませた名前の並びを覚えておく。
+  std::vector<char const*> params;
+  for(auto dummies = args(lambda); !null(dummies); dummies = cdr(dummies)) {
+    if(atomp(dummies) || !symbolp(car(dummies))) {
+      site.state = SiteState::Generic;
+      return;
+    }
+    params.push_back(cast<Tag::Symbol>(car(dummies)));
+  }
+  site.params = std::move(params);
+  site.state = SiteState::Specialized;
+}
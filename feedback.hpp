@@ -0,0 +1,91 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "arguments.hpp"
+#include "primitive.hpp"
+#include "sexp.hpp"
+
+// 呼び出し位置ごとの型 feedback。
+//
+// 評価器は (f a b) を初めて評価したとき、先頭の記号 f を CallSite を持つ Tag::Site の
+// 値に書き換える。以後は名前で primitive を探し直さずに済む。primitive の位置は
+// 実引数の tag を warmup 回観測し、毎回同じで、その tag 用の速い実装があれば
+// Specialized になる。Specialized の位置は tag を確かめるだけで速い実装を呼び、
+// 外れたら Warmup に戻って観測し直す。外れるのが max_deopts 回に達したら Generic に
+// 落ちて二度と特殊化しない。Pure な primitive の実引数がすべて literal なら、最初の
+// 結果を覚えて Constant になり、以後は実引数も評価しない。
+//
+// lambda の位置では呼ばれた lambda の同一性だけを観測し、同じ lambda が続けば仮引数の
+// 検査を済ませた名前の並びで束縛する。lambda の本体は compile しないので、実引数の tag
+// を観測しても使い道がなく、見ない。
+
+using SpecialFormFn = std::pair<Env, SExp> (*)(Env, SExp);
+
+enum class SiteKind {
+  Primitive,
+  SpecialForm,
+  Lambda,
+};
+
+enum class SiteState {
+  Warmup,
+  Specialized,
+  Generic,
+  Constant,
+};
+
+struct CallSite {
+  // SExp の既定の constructor は cell を確保するので、nil で初期化する。
+  SExp symbol = nil;
+  SiteKind kind;
+  SiteState state;
+  int hits;
+  long deopts;
+  // Primitive
+  Primitive const* primitive;
+  bool foldable;
+  SExp value = nil;
+  PrimitiveFn fast;
+  size_t arity;
+  Tag tags[2];
+  // SpecialForm
+  SpecialFormFn special;
+  // Lambda
+  SExp lambda = nil;
+  std::vector<char const*> params;
+};
+
+// 特殊化が外れてから観測し直すのは、この回数まで。
+constexpr long max_deopts = 4;
+
+// form の先頭を CallSite に置き換えて、その CallSite を返す。
+CallSite* install_primitive_site(SExp form, Primitive const& primitive);
+CallSite* install_specialform_site(SExp form, SpecialFormFn special);
+CallSite* install_lambda_site(SExp form);
+
+// Warmup 中の位置に実引数を観測させる。
+void observe(CallSite& site, Args args);
+// lambda の位置で、呼ばれた lambda を観測させる。
+void observe_lambda(CallSite& site, SExp lambda);
+
+inline bool guard(CallSite const& site, Args args) {
+  if(args.size != site.arity) return false;
+  for(size_t i{}; i < args.size; ++i) {
+    if(type(args[i]) != site.tags[i]) return false;
+  }
+  return true;
+}
+
+// 実引数を評価した結果を覚えて、以後はそれを返す。
+inline void fold(CallSite& site, SExp value) {
+  site.value = value;
+  site.state = SiteState::Constant;
+}
+
+inline void deopt(CallSite& site) {
+  ++site.deopts;
+  site.state = site.deopts < max_deopts ? SiteState::Warmup : SiteState::Generic;
+  site.hits = 0;
+}
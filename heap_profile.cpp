@@ -0,0 +1,163 @@
+#include "heap_profile.hpp"
+#include "parse.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+namespace heap_profile {
+
+bool enabled = false;
+Context current{};
+
+namespace {
+
+// 時系列を記録する間隔。slow_tick は数千ステップに 1 回なので、これより粗くなることもある。
+constexpr auto interval = std::chrono::milliseconds{10};
+// 関数と式は多い順にこれだけ載せる。
+constexpr size_t top = 20;
+constexpr size_t form_width = 60;
+
+char const* const kind_names[kinds] = {
+  "Pair", "Nil", "String", "Integer", "Symbol", "Lambda", "Macro", "Channel", "Promise", "Site",
+  "text", "Env_", "binding", "CallSite", "task", "binary",
+};
+
+struct Counter {
+  size_t count;
+  size_t bytes;
+  void add(size_t b) {
+    ++count;
+    bytes += b;
+  }
+};
+
+struct Sample {
+  long ms;
+  Counter total;
+  std::array<size_t, kinds> bytes;
+};
+
+struct Profile {
+  Counter total{};
+  std::array<Counter, kinds> by_kind{};
+  // 同じ名前でも記号ごとに文字列が別なので、書き出すときに名前でまとめる。
+  std::unordered_map<char const*, Counter> by_function;
+  std::unordered_map<SExp_ const*, Counter> by_form;
+  std::string series_path;
+  std::vector<Sample> series;
+  std::chrono::steady_clock::time_point started;
+  std::chrono::steady_clock::time_point last;
+};
+
+Profile& profile() {
+  static Profile p;
+  return p;
+}
+
+void take_sample(Profile& p, std::chrono::steady_clock::time_point now) {
+  Sample s{std::chrono::duration_cast<std::chrono::milliseconds>(now - p.started).count(), p.total, {}};
+  for(size_t i{}; i < kinds; ++i) {
+    s.bytes[i] = p.by_kind[i].bytes;
+  }
+  p.series.push_back(s);
+  p.last = now;
+}
+
+template<typename Entries>
+void table(std::ostream& os, char const* column, Entries entries, size_t limit) {
+  std::sort(begin(entries), end(entries), [](auto const& a, auto const& b) { return a.second.bytes > b.second.bytes; });
+  os << std::setw(12) << "bytes" << std::setw(10) << "allocs" << "  " << column << '\n';
+  size_t shown{};
+  for(auto const& [name, counter]: entries) {
+    if(shown++ == limit) {
+      os << std::setw(24) << "" << "  (" << entries.size() - limit << " more)\n";
+      break;
+    }
+    os << std::setw(12) << counter.bytes << std::setw(10) << counter.count << "  " << name << '\n';
+  }
+  os << '\n';
+}
+
+std::string show_form(SExp_ const* form) {
+  if(form == nullptr) return "<outside any form>";
+  auto s = show(SExp{const_cast<SExp_*>(form)});
+  std::replace(begin(s), end(s), '\n', ' ');
+  if(s.size() > form_width) s = s.substr(0, form_width - 3) + "...";
+  return s;
+}
+
+}
+
+void record_slow(Kind kind, size_t bytes) {
+  auto& p = profile();
+  p.total.add(bytes);
+  p.by_kind[static_cast<size_t>(kind)].add(bytes);
+  p.by_function[current.function].add(bytes);
+  p.by_form[current.form].add(bytes);
+}
+
+void sample_slow() {
+  auto& p = profile();
+  auto now = std::chrono::steady_clock::now();
+  if(now - p.last >= interval) take_sample(p, now);
+}
+
+void start(std::string series_path) {
+  auto& p = profile();
+  p.series_path = std::move(series_path);
+  p.started = p.last = std::chrono::steady_clock::now();
+  enabled = true;
+}
+
+std::string report() {
+  auto& p = profile();
+  std::ostringstream os;
+  os << "heap profile: " << p.total.bytes << " bytes in " << p.total.count << " allocations (nothing is freed, so all of it is live)\n\n";
+
+  std::vector<std::pair<std::string, Counter>> kinds_;
+  for(size_t i{}; i < kinds; ++i) {
+    if(p.by_kind[i].count > 0) kinds_.emplace_back(kind_names[i], p.by_kind[i]);
+  }
+  table(os, "kind", kinds_, kinds);
+
+  std::unordered_map<std::string, Counter> merged;
+  for(auto const& [name, counter]: p.by_function) {
+    auto& m = merged[name != nullptr ? name : "<toplevel>"];
+    m.count += counter.count;
+    m.bytes += counter.bytes;
+  }
+  table(os, "function", std::vector<std::pair<std::string, Counter>>(begin(merged), end(merged)), top);
+
+  std::vector<std::pair<std::string, Counter>> forms;
+  for(auto const& [form, counter]: p.by_form) {
+    forms.emplace_back(show_form(form), counter);
+  }
+  table(os, "form", forms, top);
+  return os.str();
+}
+
+void finish(std::string const& title, std::string const& series_suffix) {
+  auto& p = profile();
+  take_sample(p, std::chrono::steady_clock::now());
+  // batch では子 process が並んで書くので、1 度の書き込みにまとめる。
+  std::cerr << ("== " + title + " ==\n" + report()) << std::flush;
+  if(p.series_path.empty()) return;
+  std::ofstream os(p.series_path + series_suffix);
+  os << "ms,allocations,bytes";
+  for(auto name: kind_names) os << ',' << name;
+  os << '\n';
+  for(auto const& s: p.series) {
+    os << s.ms << ',' << s.total.count << ',' << s.total.bytes;
+    for(auto b: s.bytes) os << ',' << b;
+    os << '\n';
+  }
+}
+
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "sexp.hpp"
+
+// --heap-profile の集計。
+//
+// 確保はすべて budget::charge を通るので、そこで何を確保したかも受け取り、有効なときだけ
+// 種類ごと、その時に走っていた名前付きの関数ごと、評価中の式ごとに数と byte 数を足す。
+// 関数の名前は lambda を define したときに覚える。無名の lambda の中の確保は、それを
+// 呼んだ名前付きの関数に数える。GC はないので、確保したものはすべて生きている。
+// slow_tick のたびに一定の間隔で合計を記録し、時系列として書き出せる。
+
+namespace heap_profile {
+
+// SExp は Tag と同じ順に並べ、その後ろに値ではない確保を置く。
+enum class Kind : uint8_t {
+  Pair,
+  Nil,
+  String,
+  Integer,
+  Symbol,
+  Lambda,
+  Macro,
+  Channel,
+  Promise,
+  Site,
+  Text,     // symbol と文字列の中身
+  Env,      // Env_
+  Binding,  // Env_ の 1 つの束縛
+  CallSite,
+  Task,     // Task と、その stack のうち始めに触るページ
+  Binary,   // read-binary が読み込んだファイル
+};
+constexpr size_t kinds = static_cast<size_t>(Kind::Binary) + 1;
+
+// 確保を数える先。task を切り替えるときは task ごとに持ち替える。
+struct Context {
+  char const* function;
+  SExp_ const* form;
+};
+
+extern bool enabled;
+extern Context current;
+
+void record_slow(Kind kind, size_t bytes);
+void sample_slow();
+
+inline void record(Kind kind, size_t bytes) {
+  if(enabled) record_slow(kind, bytes);
+}
+
+inline void sample() {
+  if(enabled) sample_slow();
+}
+
+// series_path が空でなければ、時系列もそこに CSV で書く。
+void start(std::string series_path);
+// 集計を人が読む形で返す。
+std::string report();
+// 最後の標本を取り、title を付けた report を stderr に、時系列を series_path に
+// series_suffix を足したファイルに書く。
+void finish(std::string const& title, std::string const& series_suffix = "");
+
+// 有効なら、抜けるときに finish する。例外で抜けても report を書く。
+class Report {
+  std::string title;
+public:
+  explicit Report(std::string t) : title{std::move(t)} {}
+  ~Report() {
+    if(enabled) finish(title);
+  }
+  Report(Report const&) = delete;
+  Report& operator=(Report const&) = delete;
+};
+
+// 名前付きの lambda を呼ぶ間、確保をその関数に数える。
+class FunctionScope {
+  char const* saved;
+  bool active;
+public:
+  explicit FunctionScope(char const* name) : saved{current.function}, active{enabled && name != nullptr} {
+    if(active) current.function = name;
+  }
+  ~FunctionScope() {
+    if(active) current.function = saved;
+  }
+  FunctionScope(FunctionScope const&) = delete;
+  FunctionScope& operator=(FunctionScope const&) = delete;
+};
+
+// 式を評価する間、確保をその式に数える。
+class FormScope {
+  SExp_ const* saved;
+  bool active;
+public:
+  explicit FormScope(SExp form) : saved{current.form}, active{enabled} {
+    if(active) current.form = form.operator->();
+  }
+  ~FormScope() {
+    if(active) current.form = saved;
+  }
+  FormScope(FormScope const&) = delete;
+  FormScope& operator=(FormScope const&) = delete;
+};
+
+}
@@ -0,0 +1,72 @@
+#include "ilis.hpp"
+#include "parse.hpp"
+#include "task.hpp"
+
+#include <fstream>
+
+// <signal.h> の raise と衝突しないよう、システムヘッダの後に置く。
+#include "exceptions.hpp"
+
+namespace ilis {
+
+namespace {
+
+[[noreturn]] void mismatch(char const* expected, SExp sexp) {
+  raise_with_str(InvalidApplicationException, std::string{"expected "} + expected + ", got " + show(sexp));
+}
+
+}
+
+void define_primitive(std::string name, int arity, std::function<SExp(Args)> fn, unsigned flags) {
+  register_primitive(Primitive{std::move(name), arity, flags, nullptr, std::move(fn)});
+}
+
+SExp Convert<int>::to(int n) {
+  return make_Integer(n);
+}
+int Convert<int>::from(SExp sexp) {
+  if(!integerp(sexp)) mismatch("an integer", sexp);
+  return cast<Tag::Integer>(sexp);
+}
+
+SExp Convert<bool>::to(bool b) {
+  return b ? TRUE : FALSE;
+}
+bool Convert<bool>::from(SExp sexp) {
+  return to_bool(sexp);
+}
+
+SExp Convert<std::string>::to(std::string const& str) {
+  return make_String(str.c_str());
+}
+std::string Convert<std::string>::from(SExp sexp) {
+  if(stringp(sexp)) return cast<Tag::String>(sexp);
+  if(symbolp(sexp)) return cast<Tag::Symbol>(sexp);
+  mismatch("a string", sexp);
+}
+
+Env load(std::istream& is, Env env) {
+  auto sexps = parse(is);
+  env = eval(env, sexps).first;
+  run_tasks();
+  return env;
+}
+
+Env load_file(std::string const& path, Env env) {
+  std::ifstream is(path);
+  if(!is) {
+    raise_with_str(InvalidApplicationException, "could not open " + path);
+  }
+  return load(is, env);
+}
+
+SExp call(Env env, std::string const& name, Args args) {
+  if(auto primitive = find_primitive(name.c_str())) {
+    return ::call(*primitive, args);
+  }
+  auto f = lookup_symbol(env, name);
+  if(!lambdap(f)) mismatch("a lambda", f);
+  return apply(f, args);
+}
+
+}
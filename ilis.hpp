@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "arguments.hpp"
+#include "env.hpp"
+#include "eval.hpp"
+#include "lists.hpp"
+#include "primitive.hpp"
+#include "sexp.hpp"
+
+// ilis を C++ のプログラムに組み込むための API。
+//
+//   ilis::define_function("dot", [](std::vector<int> a, std::vector<int> b) { ... }, Pure | NoAlloc);
+//   auto env = ilis::load_file("orchestrate.lisp");
+//   auto n = ilis::from_sexp<int>(ilis::call(env, "main", 10));
+//
+// 登録した関数は組み込みの primitive と同じく名前で引かれ、call site にも同じように
+// 覚えられる。評価中の誤りは exceptions.hpp の Exception の派生として投げられる。
+
+namespace ilis {
+
+// 評価済みの実引数をそのまま受け取る関数を登録する。arity は variadic でもよい。
+// 名前は組み込みの primitive や special form、prelude の関数 (add や list など) と
+// ぶつかってはいけない。primitive は環境より先に引かれて prelude の定義を隠してしまう
+// ので、ぶつかれば InvalidApplicationException。
+void define_primitive(std::string name, int arity, std::function<SExp(Args)> fn, unsigned flags = NoFlags);
+
+// SExp と C++ の値の変換。合わない値は InvalidApplicationException。
+template<typename T>
+struct Convert;
+
+template<>
+struct Convert<SExp> {
+  static SExp to(SExp sexp) { return sexp; }
+  static SExp from(SExp sexp) { return sexp; }
+};
+template<>
+struct Convert<int> {
+  static SExp to(int n);
+  static int from(SExp sexp);
+};
+template<>
+struct Convert<bool> {
+  static SExp to(bool b);
+  static bool from(SExp sexp);
+};
+template<>
+struct Convert<std::string> {
+  static SExp to(std::string const& str);
+  static std::string from(SExp sexp);
+};
+
+template<typename T>
+struct Convert<std::vector<T>> {
+  static SExp to(std::vector<T> const& v) {
+    std::vector<SExp> items;
+    items.reserve(v.size());
+    for(auto const& x: v) items.push_back(Convert<T>::to(x));
+    return make_list(items.data(), items.size());
+  }
+  static std::vector<T> from(SExp sexp) {
+    std::vector<SExp> items;
+    ::elements(sexp, items);
+    std::vector<T> v;
+    v.reserve(items.size());
+    for(auto item: items) v.push_back(Convert<T>::from(item));
+    return v;
+  }
+};
+
+template<typename T>
+SExp to_sexp(T const& value) {
+  return Convert<T>::to(value);
+}
+inline SExp to_sexp(char const* str) {
+  return Convert<std::string>::to(str);
+}
+template<typename T>
+T from_sexp(SExp sexp) {
+  return Convert<T>::from(sexp);
+}
+
+namespace detail {
+
+template<typename R, typename... A, size_t... I>
+SExp invoke(std::function<R(A...)> const& f, Args args, std::index_sequence<I...>) {
+  if constexpr(std::is_void_v<R>) {
+    f(from_sexp<std::decay_t<A>>(args[I])...);
+    return nil;
+  } else {
+    return to_sexp(f(from_sexp<std::decay_t<A>>(args[I])...));
+  }
+}
+
+}
+
+// 引数と戻り値を Convert で変換する関数を登録する。arity は引数の数。
+template<typename R, typename... A>
+void define_function(std::string name, std::function<R(A...)> f, unsigned flags = NoFlags) {
+  define_primitive(std::move(name), sizeof...(A), [f](Args args) {
+    return detail::invoke(f, args, std::index_sequence_for<A...>{});
+  }, flags);
+}
+template<typename F>
+void define_function(std::string name, F f, unsigned flags = NoFlags) {
+  define_function(std::move(name), std::function{f}, flags);
+}
+
+// ソースを読んで env で評価し、define を足した env を返す。spawn した task も走らせ切る。
+Env load(std::istream& is, Env env = script_env());
+Env load_file(std::string const& path, Env env = script_env());
+
+// env の name を呼ぶ。name は lambda に束縛された名前か primitive。
+SExp call(Env env, std::string const& name, Args args);
+template<typename... T>
+SExp call(Env env, std::string const& name, T const&... args) {
+  if constexpr(sizeof...(T) == 0) {
+    return call(env, name, Args{nullptr, 0});
+  } else {
+    SExp items[] = {to_sexp(args)...};
+    return call(env, name, Args{items, sizeof...(T)});
+  }
+}
+
+}
@@ -0,0 +1,199 @@
+#include "lists.hpp"
+#include "eval.hpp"
+#include "exceptions.hpp"
+#include "parse.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+void elements(SExp list, std::vector<SExp>& out) {
+  auto l = list;
+  for(; !atomp(l); l = cdr(l)) {
+    out.push_back(car(l));
+  }
+  if(!null(l)) {
+    raise_with_str(InvalidApplicationException, "not a proper list: " + show(list));
+  }
+}
+
+namespace {
+
+SExp make_list(std::vector<SExp> const& v, SExp tail = nil) {
+  return make_list(v.data(), v.size(), tail);
+}
+
+SExp call(SExp f, SExp x) {
+  if(!lambdap(f)) {
+    raise_with_str(InvalidApplicationException, show(f));
+  }
+  SExp const argv[] = {x};
+  return apply(f, Args{argv, 1});
+}
+
+SExp parse_expr(char const* str) {
+  std::istringstream is(str);
+  return parse_SExpr(is);
+}
+
+// 残りの stream を expr で遅延させる。expr からは f と s が見える。
+SExp delay_rest(SExp expr, SExp f, SExp s) {
+  auto env = prelude_frame();
+  insert(env, "f", f);
+  insert(env, "s", s);
+  return make_Promise(env, expr);
+}
+
+SExp call(SExp f, SExp x, SExp y) {
+  if(!lambdap(f)) {
+    raise_with_str(InvalidApplicationException, show(f));
+  }
+  SExp const argv[] = {x, y};
+  return apply(f, Args{argv, 2});
+}
+
+}
+
+SExp reverse(SExp list) {
+  std::vector<SExp> v;
+  elements(list, v);
+  std::reverse(begin(v), end(v));
+  return make_list(v);
+}
+
+SExp copy_list(SExp list) {
+  std::vector<SExp> v;
+  elements(list, v);
+  return make_list(v);
+}
+
+SExp eval_length(Args args) {
+  int n{};
+  auto l = args[0];
+  for(; !atomp(l); l = cdr(l)) {
+    ++n;
+  }
+  if(!null(l)) {
+    raise_with_str(InvalidApplicationException, "not a proper list: " + show(args[0]));
+  }
+  return make_Integer(n);
+}
+
+// 最後のリストはコピーせずに共有する。
+SExp eval_append(Args args) {
+  if(args.size == 0) return nil;
+  std::vector<SExp> v;
+  for(size_t i{}; i + 1 < args.size; ++i) {
+    elements(args[i], v);
+  }
+  return make_list(v, args[args.size - 1]);
+}
+
+SExp eval_reverse(Args args) {
+  return reverse(args[0]);
+}
+
+// (nth n list)。範囲外なら '()。
+SExp eval_nth(Args args) {
+  assert(integerp(args[0]));
+  auto n = cast<Tag::Integer>(args[0]);
+  auto l = args[1];
+  for(; n > 0 && !atomp(l); --n) {
+    l = cdr(l);
+  }
+  return n >= 0 && !atomp(l) ? car(l) : nil;
+}
+
+SExp eval_map(Args args) {
+  std::vector<SExp> v;
+  elements(args[1], v);
+  for(auto& x: v) {
+    x = call(args[0], x);
+  }
+  return make_list(v);
+}
+
+SExp eval_filter(Args args) {
+  std::vector<SExp> v, result;
+  elements(args[1], v);
+  for(auto x: v) {
+    if(to_bool(call(args[0], x))) {
+      result.push_back(x);
+    }
+  }
+  return make_list(result);
+}
+
+// (foldl f init list) は (f (f init x0) x1) ...
+SExp eval_foldl(Args args) {
+  std::vector<SExp> v;
+  elements(args[2], v);
+  auto acc = args[1];
+  for(auto x: v) {
+    acc = call(args[0], acc, x);
+  }
+  return acc;
+}
+
+// (foldr f init list) は (f x0 (f x1 ... (f xn init)))
+SExp eval_foldr(Args args) {
+  std::vector<SExp> v;
+  elements(args[2], v);
+  auto acc = args[1];
+  for(auto it = v.rbegin(); it != v.rend(); ++it) {
+    acc = call(args[0], *it, acc);
+  }
+  return acc;
+}
+
+// (assoc key alist)。key が eq な最初の組を返す。なければ #f。
+SExp eval_assoc(Args args) {
+  for(auto l = args[1]; !atomp(l); l = cdr(l)) {
+    auto entry = car(l);
+    if(!atomp(entry) && to_bool(eq(args[0], car(entry)))) {
+      return entry;
+    }
+  }
+  return FALSE;
+}
+
+// (member x list)。x が eq な要素から始まる部分リストを返す。なければ #f。
+SExp eval_member(Args args) {
+  for(auto l = args[1]; !atomp(l); l = cdr(l)) {
+    if(to_bool(eq(args[0], car(l)))) {
+      return l;
+    }
+  }
+  return FALSE;
+}
+
+// stream は先頭だけを計算し、残りは同じ primitive を呼ぶ promise にしておく。
+// 要素を読み飛ばすときもループで回すので、長い stream でも native stack を食わない。
+SExp eval_stream_map(Args args) {
+  auto s = args[1];
+  if(null(s)) return nil;
+  static SExp const rest = parse_expr("(stream-map f (stream-cdr s))");
+  return cons(call(args[0], car(s)), delay_rest(rest, args[0], s));
+}
+
+SExp eval_stream_filter(Args args) {
+  static SExp const rest = parse_expr("(stream-filter f (stream-cdr s))");
+  for(auto s = args[1]; !null(s); s = force(cdr(s))) {
+    if(to_bool(call(args[0], car(s)))) {
+      return cons(car(s), delay_rest(rest, args[0], s));
+    }
+  }
+  return nil;
+}
+
+// (stream-take n s)。先頭 n 個をリストにする。n 個目より先は force しない。
+SExp eval_stream_take(Args args) {
+  assert(integerp(args[0]));
+  std::vector<SExp> v;
+  auto s = args[1];
+  for(auto n = cast<Tag::Integer>(args[0]); n > 0 && !null(s); --n) {
+    v.push_back(car(s));
+    if(n > 1) s = force(cdr(s));
+  }
+  return make_list(v);
+}
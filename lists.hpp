@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+
+#include "arguments.hpp"
+#include "sexp.hpp"
+
+// リスト操作。どれもループで辿るので、長いリストでも native stack を食わない。
+
+// list の要素を out に並べる。真リストでなければ InvalidApplicationException。
+void elements(SExp list, std::vector<SExp>& out);
+SExp reverse(SExp list);
+SExp copy_list(SExp list);
+
+// primitive
+SExp eval_length(Args);
+SExp eval_append(Args);
+SExp eval_reverse(Args);
+SExp eval_nth(Args);
+SExp eval_map(Args);
+SExp eval_filter(Args);
+SExp eval_foldl(Args);
+SExp eval_foldr(Args);
+SExp eval_assoc(Args);
+SExp eval_member(Args);
+SExp eval_stream_map(Args);
+SExp eval_stream_filter(Args);
+SExp eval_stream_take(Args);
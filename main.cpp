@@ -1,19 +1,112 @@
+#include <algorithm>
 #include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
 
 #include "sexp.hpp"
 #include "parse.hpp"
+#include "pool.hpp"
 #include "eval.hpp"
+#include "batch.hpp"
+#include "budget.hpp"
+#include "task.hpp"
+#include "exceptions.hpp"
 
-int main(int argc, char**) {
-  if(argc > 1) {
-    repl(std::cin);
+// --max-steps などの予算の指定を args から取り除いて limits に読み込む。
+std::vector<std::string> parse_limits(std::vector<std::string> const& args, Limits& limits) {
+  std::vector<std::string> rest;
+  for(size_t i{}; i < args.size(); ++i) {
+    if(i + 1 < args.size()) {
+      if(args[i] == "--max-steps") {
+        limits.steps = std::stol(args[++i]);
+        continue;
+      }
+      if(args[i] == "--max-heap") {
+        limits.heap = std::stoul(args[++i]);
+        continue;
+      }
+      if(args[i] == "--timeout") {
+        limits.time = std::chrono::milliseconds{std::stol(args[++i])};
+        continue;
+      }
+      if(args[i] == "--max-depth") {
+        limits.depth = std::stoi(args[++i]);
+        continue;
+      }
+    }
+    rest.push_back(args[i]);
   }
+  return rest;
+}
 
-  auto sexps = parse(std::cin);
-  std::cout << show(sexps);
-  std::cout << "--------------------------------" << std::endl;
-  auto sexp = eval(sexps);
-  std::cout << show(sexp) << std::endl;
+int batch_main(std::vector<std::string> args, Limits const& limits) {
+  int jobs = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+  std::vector<std::string> paths;
+  for(size_t i{}; i < args.size(); ++i) {
+    if((args[i] == "-j" || args[i] == "--jobs") && i + 1 < args.size()) {
+      jobs = std::stoi(args[++i]);
+    } else {
+      paths.push_back(args[i]);
+    }
+  }
+  if(paths.empty()) {
+    std::cerr << "usage: ilis --batch [-j N] file-or-directory..." << std::endl;
+    return 2;
+  }
+  return run_batch(paths, jobs, limits);
+}
+
+int main(int argc, char** argv) {
+  Limits limits;
+  auto args = parse_limits(std::vector<std::string>(argv + 1, argv + argc), limits);
+  if(auto it = std::find(begin(args), end(args), "--share-quoted"); it != end(args)) {
+    share_quoted = true;
+    args.erase(it);
+  }
+  // --heap-profile で確保を数え、終わるときに stderr に書く。--heap-series FILE で時系列も書く。
+  // --batch では script ごとに FILE.<番号>.<script の名前> に書く。
+  std::string heap_series;
+  if(auto it = std::find(begin(args), end(args), "--heap-series"); it != end(args) && it + 1 != end(args)) {
+    heap_series = *(it + 1);
+    args.erase(it, it + 2);
+    heap_profile::start(heap_series);
+  }
+  if(auto it = std::find(begin(args), end(args), "--heap-profile"); it != end(args)) {
+    args.erase(it);
+    if(!heap_profile::enabled) heap_profile::start(heap_series);
+  }
+  if(!args.empty() && args[0] == "--batch") {
+    return batch_main(std::vector<std::string>(begin(args) + 1, end(args)), limits);
+  }
+  // 例外で抜けるときも、Report が抜ける前に heap profile を書く。
+  if(!args.empty()) {
+    try {
+      heap_profile::Report report{"repl"};
+      repl(std::cin, limits);
+    } catch(UnexpectedEoFException const&) {
+      // repl は入力の終わりでしか抜けない。
+      return 0;
+    } catch(Exception const&) {
+      std::cerr << "*** " << describe_exception() << " ***" << std::endl;
+      return 1;
+    }
+  }
+
+  try {
+    heap_profile::Report report{"stdin"};
+    auto sexps = parse(std::cin);
+    std::cout << show(sexps);
+    std::cout << "--------------------------------" << std::endl;
+    BudgetScope budget{limits};
+    auto sexp = eval(sexps);
+    run_tasks();
+    std::cout << show(sexp) << std::endl;
+  } catch(Exception const&) {
+    std::cerr << "*** " << describe_exception() << " ***" << std::endl;
+    return 1;
+  }
 
   return 0;
 }
@@ -1,16 +1,19 @@
 #include "parse.hpp"
 
+#include <cstring>
 #include <sstream>
 
 #include "exceptions.hpp"
 #include "utils.hpp"
+#include "feedback.hpp"
+#include "pool.hpp"
 
 bool number_char(char c) {
   return ('0' <= c && c <= '9');
 }
 
 bool identifier_char(char c) {
-  auto chars = std::experimental::make_array('-', '+', '?', '#');
+  auto chars = std::experimental::make_array('-', '+', '?', '#', '*');
   return ('a' <= c && c <= 'z')
       || ('A' <= c && c <= 'Z')
       || number_char(c)
@@ -52,19 +55,49 @@ int read_integer(std::istream& is) {
   return res;
 }
 
-SExp parse_SExpr(std::istream& is);
+// shared のときは quote の中身として読み、pool.hpp の共有された定数を返す。
+SExp parse_SExpr(std::istream& is, bool shared);
 
-SExp parse_Symbol(std::istream& is) {
+SExp parse_Symbol(std::istream& is, bool shared) {
   std::string str{read_identifier(is)};
-  return make_Symbol(str.c_str());
+  return shared ? shared_symbol(str.c_str()) : make_Symbol(str.c_str());
 }
 
-SExp parse_Integer(std::istream& is) {
+SExp parse_Integer(std::istream& is, bool shared) {
   int n = read_integer(is);
-  return make_Integer(n);
+  return shared ? shared_integer(n) : make_Integer(n);
 }
 
-SExp parse_List(std::istream& is) {
+SExp parse_String(std::istream& is, bool shared) {
+  char c;
+  is.get(c); // '"'
+  std::stringstream ss;
+  while(is.get(c)) {
+    if(c == '"') {
+      return shared ? shared_string(ss.str().c_str()) : make_String(ss.str().c_str());
+    }
+    if(c == '\\') {
+      if(!is.get(c)) break;
+      switch(c) {
+      case 'n':
+        c = '\n';
+        break;
+      case 't':
+        c = '\t';
+        break;
+      case '"':
+      case '\\':
+        break;
+      default:
+        raise_with_char(UnexpectedCharException, c);
+      }
+    }
+    ss << c;
+  }
+  raise(UnexpectedEoFException);
+}
+
+SExp parse_List(std::istream& is, bool shared) {
   char c;
   is.get(c);
   if(c != '(') {
@@ -74,20 +107,24 @@ SExp parse_List(std::istream& is) {
   int c_;
   std::vector<SExp> sexps;
   skip_spaces(is);
+  // (quote ...) と書いたときも、'... と同じく中身だけを共有する。
+  bool quoted = false;
   while(c_ = is.peek(), c_ != EOF && c_ != ')') {
-    auto sexp = parse_SExpr(is);
+    auto sexp = parse_SExpr(is, shared || quoted);
+    if(sexps.empty() && !shared && share_quoted && symbolp(sexp) && !std::strcmp(cast<Tag::Symbol>(sexp), "quote")) {
+      quoted = true;
+    }
     sexps.push_back(sexp);
     skip_spaces(is);
   }
   is.get(c);
-  SExp sexp = nil;
-  for(int i{static_cast<int>(sexps.size()) - 1}; i >= 0; --i) {
-    sexp = cons(sexps[i], sexp);
+  if(quoted) {
+    return cons(sexps[0], shared_list(std::vector<SExp>(begin(sexps) + 1, end(sexps))));
   }
-  return sexp;
+  return shared ? shared_list(sexps) : make_list(sexps.data(), sexps.size());
 }
 
-SExp parse_SExpr(std::istream& is) {
+SExp parse_SExpr(std::istream& is, bool shared) {
   int c_ = is.peek();
   if(c_ == EOF) {
     raise(UnexpectedEoFException);
@@ -97,21 +134,30 @@ SExp parse_SExpr(std::istream& is) {
 
   switch(c) {
   case '\'': {
+    // 式の中の quote の cell は評価器が書き換えるので、共有するのは中身だけ。
+    auto datum = parse_SExpr(is, shared || share_quoted);
+    if(shared) {
+      return shared_list({shared_symbol("quote")}, datum);
+    }
     return cons(
       make_Symbol("quote"),
-      parse_SExpr(is)
+      datum
     );
   }
   case '(': {
     is.unget();
-    return parse_List(is);
+    return parse_List(is, shared);
+  }
+  case '"': {
+    is.unget();
+    return parse_String(is, shared);
   }
   default: { // symbol or integer
     is.unget();
     if(number_char(c)) {
-      return parse_Integer(is);
+      return parse_Integer(is, shared);
     } else if(identifier_char(c)) {
-      return parse_Symbol(is);
+      return parse_Symbol(is, shared);
     } else {
       raise(NeverComeException);
     }
@@ -119,6 +165,10 @@ SExp parse_SExpr(std::istream& is) {
   }
 }
 
+SExp parse_SExpr(std::istream& is) {
+  return parse_SExpr(is, false);
+}
+
 std::vector<SExp> parse(std::istream& is) {
   std::vector<SExp> v;
   int c;
@@ -130,23 +180,45 @@ std::vector<SExp> parse(std::istream& is) {
   return v;
 }
 
+// 長いリストでも stack を食わないよう、cdr 方向はループで辿る。
 std::string show_list_impl(SExp sexp) {
   assert(!atomp(sexp));
-  auto car_ = car(sexp);
-  auto cdr_ = cdr(sexp);
-  if(null(cdr_)) {
-    return show(car_);
-  }
-  if(atomp(cdr_)) {
-    return show(car_) + " . " + show(cdr_);
+  std::string s{show(car(sexp))};
+  for(auto cdr_ = cdr(sexp); !null(cdr_); cdr_ = cdr(cdr_)) {
+    if(atomp(cdr_)) {
+      s += " . " + show(cdr_);
+      break;
+    }
+    s += ' ' + show(car(cdr_));
   }
-  return show(car_) + ' ' + show_list_impl(cdr_);
+  return s;
 }
 
 std::string show_list(SExp sexp) {
   return '(' + show_list_impl(sexp) + ')';
 }
 
+std::string show_string(char const* str) {
+  std::string s{'"'};
+  for(; *str; ++str) {
+    switch(*str) {
+    case '\n':
+      s += "\\n";
+      break;
+    case '\t':
+      s += "\\t";
+      break;
+    case '"':
+    case '\\':
+      s += '\\';
+      [[fallthrough]];
+    default:
+      s += *str;
+    }
+  }
+  return s + '"';
+}
+
 std::string show(SExp sexp) {
   std::stringstream ss;
   if(!atomp(sexp)) { // pair
@@ -157,10 +229,18 @@ std::string show(SExp sexp) {
     ss << "'()";
   } else if(symbolp(sexp)) {
     ss << std::string{cast<Tag::Symbol>(sexp)};
+  } else if(stringp(sexp)) {
+    ss << show_string(cast<Tag::String>(sexp));
   } else if(lambdap(sexp)) {
     ss << "(lambda " << show_list(args(sexp)) << ' ' << show_list(body(sexp)) << ')';
   } else if(macrop(sexp)) {
     ss << "(defmacro )";
+  } else if(channelp(sexp)) {
+    ss << "#<channel>";
+  } else if(promisep(sexp)) {
+    ss << "#<promise>";
+  } else if(sitep(sexp)) {
+    return show(cast<Tag::Site>(sexp)->symbol);
   }
   return ss.str();
 }
@@ -189,6 +269,12 @@ std::string show(Tag tag) {
     return "Lambda";
   case Tag::Macro:
     return "Macro";
+  case Tag::Channel:
+    return "Channel";
+  case Tag::Promise:
+    return "Promise";
+  case Tag::Site:
+    return "Site";
   default:
     raise(NeverComeException);
   }
@@ -0,0 +1,74 @@
+#include "pool.hpp"
+#include "sexp_impl.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+bool share_quoted = false;
+
+namespace {
+
+// 要素と末尾の cell の並び。要素はすでに共有されているので、同一性で比べればよい。
+using Shape = std::vector<SExp_ const*>;
+
+struct ShapeHash {
+  size_t operator()(Shape const& shape) const {
+    size_t h = shape.size();
+    for(auto p: shape) {
+      h ^= std::hash<SExp_ const*>{}(p) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+    }
+    return h;
+  }
+};
+
+std::unordered_map<std::string, SExp> symbols;
+std::unordered_map<std::string, SExp> strings;
+std::unordered_map<int, SExp> integers;
+std::unordered_map<Shape, SExp, ShapeHash> lists;
+
+SExp freeze(SExp sexp) {
+  sexp->_immutable = true;
+  return sexp;
+}
+
+template<typename Make>
+SExp shared_atom(std::unordered_map<std::string, SExp>& table, char const* text, Make make) {
+  auto it = table.find(text);
+  if(it != end(table)) return it->second;
+  return table.emplace(text, freeze(make(text))).first->second;
+}
+
+}
+
+SExp shared_symbol(char const* name) {
+  return shared_atom(symbols, name, make_Symbol);
+}
+
+SExp shared_string(char const* str) {
+  return shared_atom(strings, str, make_String);
+}
+
+SExp shared_integer(int n) {
+  if(-small_integer_max <= n && n <= small_integer_max) return make_Integer(n);
+  auto it = integers.find(n);
+  if(it != end(integers)) return it->second;
+  return integers.emplace(n, freeze(make_Integer(n))).first->second;
+}
+
+SExp shared_list(std::vector<SExp> const& items, SExp tail) {
+  if(items.empty()) return tail;
+  Shape shape;
+  shape.reserve(items.size() + 1);
+  for(auto item: items) shape.push_back(ptr(item));
+  shape.push_back(ptr(tail));
+  auto it = lists.find(shape);
+  if(it != end(lists)) return it->second;
+  auto list = make_list(items.data(), items.size(), tail);
+  auto cells = const_cast<SExp_*>(ptr(list));
+  for(size_t i{}; i < items.size(); ++i) {
+    cells[i]._immutable = true;
+  }
+  return lists.emplace(std::move(shape), list).first->second;
+}
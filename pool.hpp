@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+
+#include "sexp.hpp"
+
+// quote された定数の共有 (hash-consing)。
+//
+// 同じ形の定数は 1 つの値にまとめ、その cell には immutable の印を付ける。
+// 同じ定数を何度も書くデータの多い script で cell の数が減り、同じ形の定数は
+// 同じ cell になるので eq でも比べられ、equal は中を見ずに済む。
+// parse_SExpr は表を先に引くので、すでにある定数のために cell を確保しない。
+// リストは要素と末尾が同じものをまとめる。cdr-coding はそのまま保つ。
+
+// parse_SExpr が quote の中身を共有するか。'x と (quote x) のどちらの書き方でも効く。
+// 既定では共有しない。
+extern bool share_quoted;
+
+SExp shared_symbol(char const* name);
+SExp shared_string(char const* str);
+SExp shared_integer(int n);
+// items と tail は共有されたものでなければならない。
+SExp shared_list(std::vector<SExp> const& items, SExp tail = nil);
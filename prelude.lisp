@@ -1,7 +1,9 @@
 (define cadr (lambda (x) (car (cdr x))))
 (define cddr (lambda (x) (cdr (cdr x))))
+(define caddr (lambda (x) (nth 2 x)))
+(define last (lambda (l) (nth (dec (length l)) l)))
 
-(define null (lambda (x) (if (eq '() '()) #t #f)))
+(define null (lambda (x) (eq x '())))
 (define list (lambda xs xs))
 
 (define add (lambda (x y)
@@ -19,3 +21,6 @@
       (inc (neg (inc x)))))))
 
 (define not (lambda (x) (eq x #f)))
+
+(define stream-car (lambda (s) (car s)))
+(define stream-cdr (lambda (s) (force (cdr s))))
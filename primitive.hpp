@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include "arguments.hpp"
+#include "budget.hpp"
+#include "sexp.hpp"
+
+// primitive の登録簿。組み込みの primitive も、埋め込む側が登録した関数も同じ形で並ぶ。
+// 名前は環境より先に引かれるので、同じ名前は二度登録できない。
+
+using PrimitiveFn = SExp (*)(Args);
+
+// call site はこれを見て最適化してよい。
+enum PrimitiveFlag : unsigned {
+  NoFlags = 0,
+  // 副作用がなく、結果は実引数の値だけで決まる。実引数がすべて literal の呼び出しは
+  // 最初の結果を使い回す。
+  Pure = 1u << 0,
+  // ilis の値を確保しない。DEBUG ビルドでは確かめる。
+  NoAlloc = 1u << 1,
+};
+
+constexpr int variadic = -1;
+
+struct Primitive {
+  std::string name;
+  int arity;
+  unsigned flags;
+  // 組み込みは関数ポインタ、埋め込む側のものは host で呼ぶ。
+  PrimitiveFn fn;
+  std::function<SExp(Args)> host;
+};
+
+Primitive const* find_primitive(char const* name);
+// primitive や special form、prelude の定義と名前がぶつかれば例外。
+void register_primitive(Primitive primitive);
+
+[[noreturn]] void arity_mismatch(Primitive const& primitive, Args args);
+
+inline SExp call(Primitive const& primitive, Args args) {
+  if(primitive.arity != variadic && args.size != static_cast<size_t>(primitive.arity)) {
+    arity_mismatch(primitive, args);
+  }
+#ifdef DEBUG
+  auto heap_left = budget::current.heap_left;
+  auto ret = primitive.fn != nullptr ? primitive.fn(args) : primitive.host(args);
+  assert(!(primitive.flags & NoAlloc) || budget::current.heap_left == heap_left);
+  return ret;
+#else
+  return primitive.fn != nullptr ? primitive.fn(args) : primitive.host(args);
+#endif
+}
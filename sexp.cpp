@@ -1,34 +1,11 @@
 #include "sexp.hpp"
+#include "sexp_impl.hpp"
+#include "budget.hpp"
 
 #include <cstring>
 
-union Value {
-  Pair* pair;
-  char const* symbol;
-  int integer;
-  Lambda* lambda;
-};
-
-struct SExp_ {
-  Tag _tag;
-  Value _value;
-  SExp_() : _tag{Tag::Nil}, _value{} {}
-  SExp_(Tag t, Value v) : _tag{t}, _value{v} {}
-};
-
-struct Pair {
-  SExp _car;
-  SExp _cdr;
-  Pair(SExp car, SExp cdr) : _car{car}, _cdr{cdr} {}
-};
-
-struct Lambda {
-  Env env;
-  SExp args;
-  SExp body;
-};
-
 SExp::SExp() {
+  budget::charge(sizeof(SExp_), heap_profile::Kind::Nil);
   _sexp = new SExp_{};
 }
 
@@ -44,14 +21,39 @@ Lambda const* cast_<Tag::Lambda>::operator()(SExp const& sexp) {
   assert(sexp->_tag == Tag::Lambda);
   return sexp->_value.lambda;
 }
+char const* cast_<Tag::String>::operator()(SExp const& sexp) {
+  assert(sexp->_tag == Tag::String);
+  return sexp->_value.string;
+}
+CallSite* cast_<Tag::Site>::operator()(SExp const& sexp) {
+  assert(sexp->_tag == Tag::Site);
+  return sexp->_value.site;
+}
+Channel* cast_<Tag::Channel>::operator()(SExp const& sexp) {
+  assert(sexp->_tag == Tag::Channel);
+  return sexp->_value.channel;
+}
 
 SExp eq(SExp lhs, SExp rhs) {
   if(lhs->_tag != rhs->_tag) return FALSE;
+  if(lhs->_tag == Tag::Nil) return TRUE;
   if(lhs->_tag == Tag::Integer) return lhs->_value.integer == rhs->_value.integer ? TRUE : FALSE;
   if(lhs->_tag == Tag::Symbol) return !std::strcmp(lhs->_value.symbol, rhs->_value.symbol) ? TRUE : FALSE;
+  if(lhs->_tag == Tag::String) return !std::strcmp(lhs->_value.string, rhs->_value.string) ? TRUE : FALSE;
   return lhs == rhs ? TRUE : FALSE;
 }
 
+SExp equal(SExp lhs, SExp rhs) {
+  // リストの背骨は回して辿り、再帰するのは car だけにする。
+  while(true) {
+    if(lhs == rhs) return TRUE;
+    if(lhs->_tag != Tag::Pair || rhs->_tag != Tag::Pair) return eq(lhs, rhs);
+    if(!to_bool(equal(car(lhs), car(rhs)))) return FALSE;
+    lhs = cdr(lhs);
+    rhs = cdr(rhs);
+  }
+}
+
 bool atomp(SExp sexp) {
   return sexp->_tag != Tag::Pair;
 }
@@ -64,6 +66,10 @@ bool symbolp(SExp sexp) {
   return sexp->_tag == Tag::Symbol;
 }
 
+bool stringp(SExp sexp) {
+  return sexp->_tag == Tag::String;
+}
+
 bool lambdap(SExp sexp) {
   return sexp->_tag == Tag::Lambda;
 }
@@ -72,10 +78,26 @@ bool macrop(SExp sexp) {
   return sexp->_tag == Tag::Macro;
 }
 
+bool channelp(SExp sexp) {
+  return sexp->_tag == Tag::Channel;
+}
+
+bool promisep(SExp sexp) {
+  return sexp->_tag == Tag::Promise;
+}
+
+bool sitep(SExp sexp) {
+  return sexp->_tag == Tag::Site;
+}
+
 bool null(SExp sexp) {
   return sexp->_tag == Tag::Nil;
 }
 
+bool immutablep(SExp sexp) {
+  return sexp->_immutable;
+}
+
 Tag type(SExp sexp) {
   return sexp->_tag;
 }
@@ -92,12 +114,14 @@ SExp const FALSE = make_Symbol("#f");
 char* copy_str(char const* str) {
   // 現代のコードではない。あとでGCを書く。
   size_t len = std::strlen(str);
+  budget::charge(len + 1, heap_profile::Kind::Text);
   char* new_str = new char[len + 1];
   std::strcpy(new_str, str);
   return new_str;
 }
 
 SExp make_Symbol(char const* str) {
+  budget::charge(sizeof(SExp_), heap_profile::Kind::Symbol);
   Value v;
   v.symbol = copy_str(str); // leak
   return new SExp_ {
@@ -106,7 +130,31 @@ SExp make_Symbol(char const* str) {
   };
 }
 
+SExp make_String(char const* str) {
+  budget::charge(sizeof(SExp_), heap_profile::Kind::String);
+  Value v;
+  v.string = copy_str(str); // leak
+  return new SExp_ {
+    Tag::String,
+    v,
+  };
+}
+
+// 定数初期化されるので、他の翻訳単位の静的な初期化の途中から使ってもよい。
+// 中身は最初に使うときに入れる。
+SExp_ small_integers[2 * small_integer_max + 1];
+
 SExp make_Integer(int n) {
+  if(-small_integer_max <= n && n <= small_integer_max) {
+    auto& cell = small_integers[n + small_integer_max];
+    if(cell._tag != Tag::Integer) {
+      cell._tag = Tag::Integer;
+      cell._immutable = true;
+      cell._value.integer = n;
+    }
+    return &cell;
+  }
+  budget::charge(sizeof(SExp_), heap_profile::Kind::Integer);
   Value v;
   v.integer = n;
   return new SExp_ {
@@ -116,6 +164,7 @@ SExp make_Integer(int n) {
 }
 
 SExp make_Lambda(Env env, SExp args, SExp body) {
+  budget::charge(sizeof(SExp_) + sizeof(Lambda), heap_profile::Kind::Lambda);
   Value v;
   v.lambda = new Lambda{env, args, body}; // leak
   return new SExp_ {
@@ -125,6 +174,7 @@ SExp make_Lambda(Env env, SExp args, SExp body) {
 }
 
 SExp make_Macro(Env env, SExp args, SExp body) {
+  budget::charge(sizeof(SExp_) + sizeof(Lambda), heap_profile::Kind::Macro);
   Value v;
   v.lambda = new Lambda{env, args, body}; // leak
   return new SExp_ {
@@ -133,7 +183,38 @@ SExp make_Macro(Env env, SExp args, SExp body) {
   };
 }
 
+SExp make_Channel(Channel* channel) {
+  budget::charge(sizeof(SExp_), heap_profile::Kind::Channel);
+  Value v;
+  v.channel = channel;
+  return new SExp_ {
+    Tag::Channel,
+    v,
+  };
+}
+
+SExp make_Promise(Env env, SExp expr) {
+  budget::charge(sizeof(SExp_) + sizeof(Promise), heap_profile::Kind::Promise);
+  Value v;
+  v.promise = new Promise{env, expr, nil, false}; // leak
+  return new SExp_ {
+    Tag::Promise,
+    v,
+  };
+}
+
+SExp make_Site(CallSite* site) {
+  budget::charge(sizeof(SExp_), heap_profile::Kind::Site);
+  Value v;
+  v.site = site;
+  return new SExp_ {
+    Tag::Site,
+    v,
+  };
+}
+
 SExp cons(SExp car, SExp cdr) {
+  budget::charge(sizeof(SExp_) + sizeof(Pair), heap_profile::Kind::Pair);
   Value v;
   v.pair = new Pair{ car, cdr }; // will leak
   return new SExp_ {
@@ -142,13 +223,41 @@ SExp cons(SExp car, SExp cdr) {
   };
 }
 
+// n 個の cell を 1 つの配列に確保する。tail が nil でなければ、最後の cell だけ Normal にする。
+SExp make_list(SExp const* items, size_t n, SExp tail) {
+  if(n == 0) return tail;
+  bool proper = null(tail);
+  budget::charge(n * sizeof(SExp_) + (proper ? 0 : sizeof(Pair)), heap_profile::Kind::Pair);
+  auto cells = new SExp_[n]; // leak
+  for(size_t i{}; i < n; ++i) {
+    cells[i]._tag = Tag::Pair;
+    cells[i]._cdr_code = CdrCode::Next;
+    cells[i]._value.element = const_cast<SExp_*>(items[i].operator->());
+  }
+  if(proper) {
+    cells[n - 1]._cdr_code = CdrCode::Last;
+  } else {
+    cells[n - 1]._cdr_code = CdrCode::Normal;
+    cells[n - 1]._value.pair = new Pair{items[n - 1], tail}; // leak
+  }
+  return &cells[0];
+}
+
 SExp car(SExp sexp) {
   assert(sexp->_tag == Tag::Pair);
-  return sexp->_value.pair->_car;
+  return pair_car(sexp.operator->());
 }
 SExp cdr(SExp sexp) {
   assert(sexp->_tag == Tag::Pair);
-  return sexp->_value.pair->_cdr;
+  return pair_cdr(sexp.operator->());
+}
+void set_car(SExp sexp, SExp car) {
+  assert(sexp->_tag == Tag::Pair && !sexp->_immutable);
+  if(sexp->_cdr_code == CdrCode::Normal) {
+    sexp->_value.pair->_car = car;
+  } else {
+    sexp->_value.element = car.operator->();
+  }
 }
 
 Env env(SExp lambda) {
@@ -164,6 +273,16 @@ SExp body(SExp lambda) {
   return lambda->_value.lambda->body;
 }
 
+char const* lambda_name(SExp lambda) {
+  assert(lambda->_tag == Tag::Lambda);
+  return lambda->_value.lambda->name;
+}
+void name_lambda(SExp lambda, char const* name) {
+  assert(lambda->_tag == Tag::Lambda);
+  auto l = lambda->_value.lambda;
+  if(l->name == nullptr) l->name = name;
+}
+
 SExp macro_args(SExp lambda) {
   assert(lambda->_tag == Tag::Macro);
   return lambda->_value.lambda->args;
@@ -172,3 +291,29 @@ SExp macro_body(SExp lambda) {
   assert(lambda->_tag == Tag::Macro);
   return lambda->_value.lambda->body;
 }
+
+bool forced(SExp promise) {
+  assert(promise->_tag == Tag::Promise);
+  return promise->_value.promise->forced;
+}
+Env promise_env(SExp promise) {
+  assert(promise->_tag == Tag::Promise);
+  return promise->_value.promise->env;
+}
+SExp promise_expr(SExp promise) {
+  assert(promise->_tag == Tag::Promise);
+  return promise->_value.promise->expr;
+}
+SExp promise_value(SExp promise) {
+  assert(promise->_tag == Tag::Promise);
+  return promise->_value.promise->value;
+}
+void fulfill(SExp promise, SExp value) {
+  assert(promise->_tag == Tag::Promise);
+  auto p = promise->_value.promise;
+  p->value = value;
+  p->forced = true;
+  // もう評価しないので、捕まえていた環境と式は離す。
+  p->env = Env{static_cast<Env_*>(nullptr)};
+  p->expr = nil;
+}
@@ -6,6 +6,9 @@
 
 struct Pair;
 struct Lambda;
+struct Channel;
+struct Promise;
+struct CallSite;
 
 enum class Tag {
   Pair,
@@ -15,6 +18,9 @@ enum class Tag {
   Symbol,
   Lambda,
   Macro,
+  Channel,
+  Promise,
+  Site,
 };
 
 struct SExp_;
@@ -36,14 +42,22 @@ public:
 };
 
 SExp eq(SExp lhs, SExp rhs);
+// 構造の等しさ。同じ cell なら中を見ない。
+SExp equal(SExp lhs, SExp rhs);
 bool to_bool(SExp);
 
 bool atomp(SExp sexp);
 bool integerp(SExp sexp);
 bool symbolp(SExp sexp);
+bool stringp(SExp sexp);
 bool lambdap(SExp sexp);
 bool macrop(SExp sexp);
+bool channelp(SExp sexp);
+bool promisep(SExp sexp);
+bool sitep(SExp sexp);
 bool null(SExp sexp);
+// 共有されているので書き換えてはいけない cell か。
+bool immutablep(SExp sexp);
 
 Tag type(SExp);
 
@@ -59,29 +73,60 @@ struct cast_<Tag::Symbol> {
   char const* operator()(SExp const& sexp);
 };
 template<>
+struct cast_<Tag::String> {
+  char const* operator()(SExp const& sexp);
+};
+template<>
 struct cast_<Tag::Lambda> {
   Lambda const* operator()(SExp const& sexp);
 };
 
+template<>
+struct cast_<Tag::Site> {
+  CallSite* operator()(SExp const& sexp);
+};
+template<>
+struct cast_<Tag::Channel> {
+  Channel* operator()(SExp const& sexp);
+};
+
 template<enum Tag t>
 cast_<t> cast = cast_<t>{};
 
 SExp make_Symbol(char const* str);
+SExp make_String(char const* str);
+// -small_integer_max から small_integer_max までは、確保せずに共有の表から返す。
+constexpr int small_integer_max = 1024;
 SExp make_Integer(int n);
 SExp make_Lambda(Env, SExp args, SExp body);
 SExp make_Macro(Env, SExp args, SExp body);
+SExp make_Channel(Channel*);
+SExp make_Promise(Env, SExp expr);
+SExp make_Site(CallSite*);
 
 extern SExp const nil;
 extern SExp const TRUE;
 extern SExp const FALSE;
 
 SExp cons(SExp car, SExp cdr);
+// items[0] から n 個を並べ、最後の cdr を tail にしたリスト。
+SExp make_list(SExp const* items, size_t n, SExp tail = nil);
 
 SExp car(SExp sexp);
 SExp cdr(SExp sexp);
+// 評価器が呼び出し位置の先頭を CallSite に書き換えるためだけに使う。
+void set_car(SExp pair, SExp car);
 
 Env env(SExp lambda);
 SExp args(SExp lambda);
 SExp body(SExp lambda);
+// 最初に define された名前。無名なら nullptr。
+char const* lambda_name(SExp lambda);
+void name_lambda(SExp lambda, char const* name);
 SExp macro_args(SExp macro);
 SExp macro_body(SExp macro);
+bool forced(SExp promise);
+Env promise_env(SExp promise);
+SExp promise_expr(SExp promise);
+SExp promise_value(SExp promise);
+void fulfill(SExp promise, SExp value);
@@ -0,0 +1,83 @@
+#pragma once
+
+// SExp の中身。sexp.cpp と、メモリ上の配置に依存する binary.cpp、
+// tag の検査を飛ばす feedback.cpp、共有する定数に印を付ける pool.cpp だけが使う。
+
+#include <cstdint>
+
+#include "sexp.hpp"
+
+union Value {
+  Pair* pair;
+  SExp_* element;
+  char const* symbol;
+  char const* string;
+  int integer;
+  Lambda* lambda;
+  Channel* channel;
+  Promise* promise;
+  CallSite* site;
+};
+
+// pair の cdr の持ち方 (cdr-coding)。
+// make_list が作るリストは要素数分の SExp_ を 1 つの配列に並べ、各 cell の _value に
+// car を直接置く。cdr は Next なら配列の次の cell、Last なら nil。cons が作る cell は
+// Normal で、_value.pair の Pair に car と cdr を持つ。
+enum class CdrCode : uint8_t {
+  Normal,
+  Next,
+  Last,
+};
+
+struct SExp_ {
+  Tag _tag;
+  CdrCode _cdr_code; // Tag の後ろの詰め物に収まるので、大きさは変わらない。
+  // 小さい整数の表や共有された定数。いくつもの場所から指されるので書き換えない。
+  bool _immutable;
+  Value _value;
+  constexpr SExp_() : _tag{Tag::Nil}, _cdr_code{CdrCode::Normal}, _immutable{}, _value{} {}
+  SExp_(Tag t, Value v) : _tag{t}, _cdr_code{CdrCode::Normal}, _immutable{}, _value{v} {}
+};
+
+// SExp が指している cell。
+inline SExp_ const* ptr(SExp sexp) {
+  return sexp.operator->();
+}
+
+struct Pair {
+  SExp _car;
+  SExp _cdr;
+  Pair(SExp car, SExp cdr) : _car{car}, _cdr{cdr} {}
+};
+
+inline SExp pair_car(SExp_* sexp) {
+  if(sexp->_cdr_code == CdrCode::Normal) return sexp->_value.pair->_car;
+  return sexp->_value.element;
+}
+
+inline SExp pair_cdr(SExp_* sexp) {
+  switch(sexp->_cdr_code) {
+  case CdrCode::Next:
+    return sexp + 1;
+  case CdrCode::Last:
+    return nil;
+  default:
+    return sexp->_value.pair->_cdr;
+  }
+}
+
+struct Lambda {
+  Env env;
+  SExp args;
+  SExp body;
+  // define されたときの名前。heap profile が使う。
+  char const* name{};
+};
+
+// 評価が済むと env と expr は手放し、value だけを持つ。
+struct Promise {
+  Env env;
+  SExp expr;
+  SExp value;
+  bool forced;
+};
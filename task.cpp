@@ -0,0 +1,214 @@
+#include "task.hpp"
+#include "budget.hpp"
+#include "eval.hpp"
+#include "parse.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// <signal.h> の raise と衝突しないよう、システムヘッダの後に置く。
+#include "exceptions.hpp"
+
+namespace {
+
+// 予約するのは仮想アドレスだけで、実際に使われるのは触ったページ分だけ。
+constexpr size_t stack_size = 8 << 20;
+constexpr long slice = 1000;
+
+struct Task {
+  ucontext_t context;
+  void* stack;
+  // SExp の既定の constructor は cell を確保するので、nil で初期化する。
+  SExp thunk = nil;
+  int id;
+  int depth_left;
+  uintptr_t stack_limit;
+  heap_profile::Context profile;
+  bool done;
+};
+
+struct Scheduler {
+  Task main;
+  Task* current;
+  std::deque<Task*> ready;
+  Task* zombie;
+  int next_id;
+  // 例外で終わった task の説明。run_tasks が script の失敗として投げる。
+  std::vector<std::string> failures;
+  Scheduler() : main{}, current{&main}, ready{}, zombie{nullptr}, next_id{1}, failures{} {}
+};
+
+thread_local Scheduler scheduler;
+
+void free_task(Task* task) {
+  munmap(task->stack, stack_size);
+  delete task;
+}
+
+void switch_to(Task* next) {
+  auto prev = scheduler.current;
+  if(prev == next) return;
+  prev->depth_left = budget::current.depth_left;
+  prev->stack_limit = budget::current.stack_limit;
+  prev->profile = heap_profile::current;
+  scheduler.current = next;
+  budget::current.depth_left = next->depth_left;
+  budget::current.stack_limit = next->stack_limit;
+  heap_profile::current = next->profile;
+  swapcontext(&prev->context, &next->context);
+  // ここに戻ってきたのは prev。終わった task の stack は、その上にいない今のうちに片付ける。
+  if(scheduler.zombie != nullptr) {
+    free_task(scheduler.zombie);
+    scheduler.zombie = nullptr;
+  }
+}
+
+// 次に動かす task。いなければ main に戻す (main 自身なら nullptr)。
+Task* next_task() {
+  if(!scheduler.ready.empty()) {
+    auto next = scheduler.ready.front();
+    scheduler.ready.pop_front();
+    return next;
+  }
+  if(scheduler.current != &scheduler.main) {
+    return &scheduler.main;
+  }
+  return nullptr;
+}
+
+void trampoline() {
+  auto self = scheduler.current;
+  if(scheduler.zombie != nullptr) {
+    free_task(scheduler.zombie);
+    scheduler.zombie = nullptr;
+  }
+  std::string failure;
+  try {
+    apply(self->thunk, nil);
+  } catch(BudgetExceededException const& e) {
+    failure = "budget exceeded: " + e.str;
+  } catch(Exception const& e) {
+    failure = "exception at " + e.file + ':' + std::to_string(e.line);
+  } catch(...) {
+    failure = "unknown exception";
+  }
+  if(!failure.empty()) {
+    failure = "task " + std::to_string(self->id) + ": " + failure;
+    std::cerr << "*** " << failure << " ***" << std::endl;
+    scheduler.failures.push_back(failure);
+  }
+  self->done = true;
+  scheduler.zombie = self;
+  switch_to(next_task());
+}
+
+}
+
+struct Channel {
+  std::deque<SExp> values;
+  std::deque<Task*> receivers;
+};
+
+namespace sched {
+
+thread_local long slice_left = slice;
+
+void slice_expired() {
+  slice_left = slice;
+  if(!scheduler.ready.empty()) {
+    yield();
+  }
+}
+
+}
+
+SExp spawn(SExp thunk) {
+  if(!lambdap(thunk)) {
+    raise_with_str(InvalidApplicationException, show(thunk));
+  }
+  // stack は触ったページの分しか使われない。動き出した task が触る 1 ページを見積もりに足す。
+  // 深い再帰で触るページは、main の stack と同じく数えない。
+  auto page = static_cast<size_t>(getpagesize());
+  budget::charge(sizeof(Task) + page, heap_profile::Kind::Task);
+  auto stack = mmap(nullptr, stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+  if(stack == MAP_FAILED) {
+    raise_with_str(InvalidApplicationException, "spawn: could not allocate a stack");
+  }
+  // 一番下のページは guard。溢れたら壊れる前に止まる。
+  mprotect(stack, getpagesize(), PROT_NONE);
+
+  auto task = new Task{};
+  task->stack = stack;
+  task->thunk = thunk;
+  task->id = scheduler.next_id++;
+  task->depth_left = budget::current.depth_left;
+  // 深さは段数ではなく実際の stack 残量で止める。guard page の手前で depth 超過にする。
+  task->stack_limit = budget::stack_limit_for(static_cast<char*>(stack) + stack_size, stack_size - page);
+  task->profile = heap_profile::current;
+  getcontext(&task->context);
+  task->context.uc_stack.ss_sp = stack;
+  task->context.uc_stack.ss_size = stack_size;
+  task->context.uc_link = nullptr;
+  makecontext(&task->context, trampoline, 0);
+  scheduler.ready.push_back(task);
+  return make_Integer(task->id);
+}
+
+void yield() {
+  if(scheduler.ready.empty()) return;
+  scheduler.ready.push_back(scheduler.current);
+  switch_to(next_task());
+}
+
+SExp make_channel() {
+  budget::charge(sizeof(Channel), heap_profile::Kind::Channel);
+  return make_Channel(new Channel{});
+}
+
+void send(SExp channel, SExp value) {
+  auto ch = cast<Tag::Channel>(channel);
+  ch->values.push_back(value);
+  if(!ch->receivers.empty()) {
+    scheduler.ready.push_back(ch->receivers.front());
+    ch->receivers.pop_front();
+  }
+}
+
+SExp receive(SExp channel) {
+  auto ch = cast<Tag::Channel>(channel);
+  while(ch->values.empty()) {
+    auto next = next_task();
+    if(next == nullptr) {
+      raise(DeadlockException);
+    }
+    ch->receivers.push_back(scheduler.current);
+    switch_to(next);
+    if(ch->values.empty()) {
+      // 値なしで起こされた。main が deadlock を知らされる場合がこれ。
+      auto& r = ch->receivers;
+      r.erase(std::remove(begin(r), end(r), scheduler.current), end(r));
+    }
+  }
+  auto value = ch->values.front();
+  ch->values.pop_front();
+  return value;
+}
+
+void run_tasks() {
+  while(!scheduler.ready.empty()) {
+    yield();
+  }
+  auto& failures = scheduler.failures;
+  if(failures.empty()) return;
+  auto str = failures.front();
+  if(failures.size() > 1) str += " (and " + std::to_string(failures.size() - 1) + " more)";
+  failures.clear();
+  raise_with_str(TaskFailedException, str);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "sexp.hpp"
+
+// ilis の軽量 task。task ごとに小さな native stack を持ち、ucontext で切り替える。
+// scheduler は thread ごとに 1 つで、task は spawn した thread の上でだけ動く。
+// 評価の step 数で time slice を区切るので、yield しない task も順番に実行される。
+
+struct Channel;
+
+namespace sched {
+
+extern thread_local long slice_left;
+void slice_expired();
+
+// eval の 1 ステップごとに呼ぶ。
+inline void tick() {
+  if(--slice_left <= 0) slice_expired();
+}
+
+}
+
+// thunk は引数なしの lambda。task の id を返す。
+SExp spawn(SExp thunk);
+void yield();
+SExp make_channel();
+void send(SExp channel, SExp value);
+// 値が来るまで今の task を止める。どの task も進めなくなったら DeadlockException。
+SExp receive(SExp channel);
+// 実行可能な task がなくなるまで scheduler を回す。例外で終わった task があれば、
+// それを TaskFailedException にして投げる。
+void run_tasks();
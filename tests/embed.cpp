@@ -0,0 +1,74 @@
+#include "ilis.hpp"
+
+#include <iostream>
+#include <sstream>
+
+#include "exceptions.hpp"
+
+// ilis.hpp だけで、C++ の関数を登録し、ソースを読み、ilis の関数を呼ぶ。
+
+namespace {
+
+int failures{};
+
+void check(bool ok, char const* what) {
+  if(!ok) {
+    std::cerr << "FAIL  " << what << std::endl;
+    ++failures;
+  }
+}
+
+int calls{};
+
+}
+
+int main() {
+  ilis::define_function("dot", [](std::vector<int> a, std::vector<int> b) {
+    int sum{};
+    for(size_t i{}; i < a.size() && i < b.size(); ++i) sum += a[i] * b[i];
+    return sum;
+  }, Pure);
+  ilis::define_function("square", [](int n) { ++calls; return n * n; }, Pure);
+  ilis::define_function("greet", [](std::string name) { return "hello, " + name; });
+  ilis::define_primitive("count-args", variadic, [](Args args) { return make_Integer(args.size); });
+
+  std::istringstream source{
+    "(define norm2 (lambda (v) (dot v v)))\n"
+    "(define sum-squares (lambda (n) (do ((i 0 (inc i)) (acc 0 (add acc (square i)))) ((eq i n) acc))))\n"
+    "(define folded (lambda () (square 7)))\n"
+  };
+  auto env = ilis::load(source);
+
+  check(ilis::from_sexp<int>(ilis::call(env, "norm2", std::vector<int>{1, 2, 3})) == 14, "norm2");
+  check(ilis::from_sexp<int>(ilis::call(env, "sum-squares", 4)) == 14, "sum-squares");
+  check(ilis::from_sexp<std::string>(ilis::call(env, "greet", "ilis")) == "hello, ilis", "greet");
+  check(ilis::from_sexp<int>(ilis::call(env, "count-args", 1, 2, 3)) == 3, "count-args");
+  check(ilis::from_sexp<std::vector<int>>(ilis::call(env, "reverse", std::vector<int>{1, 2})) == std::vector<int>{2, 1}, "reverse");
+
+  // Pure で実引数が literal なら、一度だけ呼ばれる。
+  calls = 0;
+  for(int i{}; i < 3; ++i) {
+    check(ilis::from_sexp<int>(ilis::call(env, "folded")) == 49, "folded");
+  }
+  check(calls == 1, "folded once");
+
+  try {
+    ilis::call(env, "square", 1, 2);
+    check(false, "arity");
+  } catch(InvalidApplicationException const&) {}
+  try {
+    ilis::define_function("car", [](int n) { return n; });
+    check(false, "redefine");
+  } catch(InvalidApplicationException const&) {}
+  try {
+    ilis::define_function("add", [](int a, int b) { return a + b; });
+    check(false, "shadow prelude");
+  } catch(InvalidApplicationException const&) {}
+  try {
+    ilis::call(env, "square", "x");
+    check(false, "conversion");
+  } catch(InvalidApplicationException const&) {}
+
+  if(failures) return 1;
+  std::cout << "ok    tests/embed" << std::endl;
+}